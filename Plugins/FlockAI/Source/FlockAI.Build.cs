@@ -9,6 +9,11 @@ public class FlockAI : ModuleRules
 		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 		ShadowVariableWarningLevel = WarningLevel.Error;
 		IncludeOrderVersion = EngineIncludeOrderVersion.Latest;
-		PublicDependencyModuleNames.AddRange(new string[] {"Core", "CoreUObject", "Engine"});
+		PublicDependencyModuleNames.AddRange(new string[] {"Core", "CoreUObject", "Engine", "NetCore"});
+		PrivateDependencyModuleNames.AddRange(new string[] {"Json"});
+		if (Target.bBuildEditor)
+		{
+			PrivateDependencyModuleNames.Add("AssetRegistry");
+		}
 	}
 }
\ No newline at end of file
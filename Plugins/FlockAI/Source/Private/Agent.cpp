@@ -2,9 +2,56 @@
 
 #include "Agent.h"
 #include "Boid.h"
+#include "FlockAI.h"
 #include "Stimulus.h"
-#include "Misc/ScopeLock.h"
+#include "FlockBehaviourModule.h"
+#include "FlockDistanceField.h"
+#include "FlockFlowField.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Components/LineBatchComponent.h"
 #include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/LevelBounds.h"
+#include "Engine/LocalPlayer.h"
+#include "GameFramework/PlayerController.h"
+#include "Net/UnrealNetwork.h"
+#include "SceneView.h"
+#include "WorldPartition/WorldPartition.h"
+#include "WorldPartition/WorldPartitionRuntimeCell.h"
+#include "WorldPartition/WorldPartitionStreamingSource.h"
+#include "WorldPartition/WorldPartitionSubsystem.h"
+
+#if WITH_EDITOR
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "UObject/Package.h"
+#endif
+
+namespace FlockAgent
+{
+	// Boids evaluated by a task of the behaviour modules
+	constexpr int32 BehaviourBlockSize = 1024;
+
+	// Phase, speed and turn rate of the boid
+	constexpr int32 NumAnimationCustomData = 3;
+
+	// Fade and number of boids of the cluster
+	constexpr int32 NumImpostorCustomData = 2;
+
+	// A boid drawn by an impostor gets its instance back when the impostor fades below this
+	constexpr float ImpostorShowFade = 0.95f;
+
+	// Spatial queries run by a task of a batch
+	constexpr int32 QueriesPerTask = 16;
+
+	// Fewest slots that get their own task and pair sums in the symmetric pair pass
+	constexpr int32 PairSlotsPerTask = 256;
+
+#if WITH_EDITOR
+	// Folder of the fields baked in the editor
+	const TCHAR* BakedAssetPath = TEXT("/Game/FlockAI/Baked");
+#endif
+}
 
 AAgent::AAgent()
 {
@@ -12,29 +59,450 @@ AAgent::AAgent()
 	HierarchicalInstancedStaticMeshComponent = CreateDefaultSubobject<UHierarchicalInstancedStaticMeshComponent>(TEXT("ShipMeshInstances"));
 	RootComponent = HierarchicalInstancedStaticMeshComponent;
 	HierarchicalInstancedStaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	ImpostorMeshComponent = CreateDefaultSubobject<UInstancedStaticMeshComponent>(TEXT("ImpostorInstances"));
+	ImpostorMeshComponent->SetupAttachment(RootComponent);
+	ImpostorMeshComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	ImpostorMeshComponent->SetMobility(EComponentMobility::Movable);
+	DistanceField = nullptr;
+	FlowField = nullptr;
+	SimulationOrigin = FVector::ZeroVector;
+
+	// Only the flock state is replicated, as a quantized fast array
+	bReplicates = true;
+	bAlwaysRelevant = true;
+	SetReplicatingMovement(false);
+	NetUpdateFrequency = 10.0f;
+	ReplicatedFlock.Agent = this;
+
+#if WITH_EDITORONLY_DATA
+	// The Agent keeps the summaries of its hibernated flocks, it must outlive the cells of its boids
+	bIsSpatiallyLoaded = false;
+#endif
+}
+
+void AAgent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AAgent, ReplicatedFlock);
+}
+
+bool AAgent::IsHeadless() const
+{
+	return bHeadlessOnDedicatedServer && IsNetMode(NM_DedicatedServer);
+}
+
+bool AAgent::IsReplicatedProxy() const
+{
+	return GetIsReplicated() && IsNetMode(NM_Client);
+}
+
+bool AAgent::ShouldReplicateFlock() const
+{
+	return GetIsReplicated() && HasAuthority() && !IsNetMode(NM_Standalone);
+}
+
+void AAgent::PreRegisterAllComponents()
+{
+	Super::PreRegisterAllComponents();
+
+	// Nothing is drawn on a dedicated server and the neighbours come from the octree, the mesh component
+	// would only cost a scene proxy and the physics bodies of the instances
+	if (IsHeadless())
+	{
+		HierarchicalInstancedStaticMeshComponent->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+		HierarchicalInstancedStaticMeshComponent->bAutoRegister = false;
+		ImpostorMeshComponent->bAutoRegister = false;
+		UE_LOG(LogFlockAI, Log, TEXT("Agent %s simulates headless, its boids are not drawn"), *GetName());
+	}
+}
+
+void AAgent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (Boids.Num() == 0)
+	{
+		SimulationOrigin = GetActorLocation();
+	}
+
+	if (bBakeDistanceFieldOnBeginPlay && (DistanceField == nullptr || !DistanceField->IsBaked()))
+	{
+		BakeDistanceField();
+	}
+
+	if (bBakeFlowFieldOnBeginPlay && (FlowField == nullptr || !FlowField->IsBaked()))
+	{
+		BakeFlowField();
+	}
+
+	// The flow field caches the goals of this flock and is traced again under the streamed levels, a baked asset is
+	// copied so neither the asset loaded in the editor nor the other Agents referencing it are changed
+	if (FlowField != nullptr && !(FlowField->GetOuter() == this && FlowField->HasAnyFlags(RF_Transient)))
+	{
+		LLM_SCOPE_BYTAG(FlockAI_Navigation);
+		FlowField = DuplicateObject<UFlockFlowField>(FlowField, this);
+		FlowField->ClearFlags(RF_Public | RF_Standalone | RF_Transactional);
+		FlowField->SetFlags(RF_Transient);
+	}
+
+	FWorldDelegates::LevelAddedToWorld.AddUObject(this, &AAgent::OnLevelAddedToWorld);
+}
+
+void AAgent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	FWorldDelegates::LevelAddedToWorld.RemoveAll(this);
+
+	if (RenderAdapter.IsValid())
+	{
+		RenderAdapter->Release();
+		RenderAdapter.Reset();
+	}
+
+	if (ImpostorAdapter.IsValid())
+	{
+		ImpostorAdapter->Release();
+		ImpostorAdapter.Reset();
+		ImpostorHandles.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AAgent::BakeDistanceField()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Navigation);
+	DistanceField = CastChecked<UFlockDistanceField>(GetBakeTarget(DistanceField, UFlockDistanceField::StaticClass(), TEXT("DistanceField")));
+	DistanceField->Bake(GetWorld(), FBox::BuildAABB(GetActorLocation(), DistanceFieldExtent),
+						DistanceFieldVoxelSize, DistanceFieldMaxDistance, ECC_WorldStatic, this);
+	MarkBakedAssetDirty(DistanceField);
+}
+
+void AAgent::BakeFlowField()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Navigation);
+	FlowField = CastChecked<UFlockFlowField>(GetBakeTarget(FlowField, UFlockFlowField::StaticClass(), TEXT("FlowField")));
+	FlowField->Bake(GetWorld(), FBox::BuildAABB(GetActorLocation(), FlowFieldExtent),
+					FlowFieldCellSize, FlowFieldMaxSlopeAngle, ECC_WorldStatic, this);
+	MarkBakedAssetDirty(FlowField);
 }
 
-void AAgent::SpawnBoid(const FVector& Location, const FRotator& Rotation)
+void AAgent::UpdateFlowFieldRegion(const FBox& Region)
+{
+	if (FlowField != nullptr && FlowField->IsBaked())
+	{
+		LLM_SCOPE_BYTAG(FlockAI_Navigation);
+		FlowField->UpdateRegion(GetWorld(), Region, ECC_WorldStatic, this);
+	}
+}
+
+void AAgent::OnLevelAddedToWorld(ULevel* Level, UWorld* World)
+{
+	// Clients follow the server boids and do not sample the flow field
+	if (World == GetWorld() && Level != nullptr && !IsReplicatedProxy())
+	{
+		UpdateFlowFieldRegion(ALevelBounds::CalculateLevelBounds(Level));
+	}
+}
+
+UObject* AAgent::GetBakeTarget(UObject* Current, UClass* Class, const TCHAR* Suffix)
+{
+#if WITH_EDITOR
+	// In the editor the field is baked into an asset of its own that other Agents and levels can reference
+	if (!GetWorld()->IsGameWorld())
+	{
+		if (Current != nullptr && Current->IsAsset())
+		{
+			Current->Modify();
+			return Current;
+		}
+
+		const FString AssetName = FString::Printf(TEXT("%s_%s_%s"), *GetWorld()->GetName(), *GetName(), Suffix);
+		UPackage* Package = CreatePackage(*FString::Printf(TEXT("%s/%s"), FlockAgent::BakedAssetPath, *AssetName));
+		UObject* Asset = NewObject<UObject>(Package, Class, *AssetName, RF_Public | RF_Standalone | RF_Transactional);
+		FAssetRegistryModule::AssetCreated(Asset);
+		Modify();
+		return Asset;
+	}
+#endif
+
+	// At runtime the bake is transient, a shared asset is never modified
+	if (Current != nullptr && Current->GetOuter() == this && Current->HasAnyFlags(RF_Transient))
+	{
+		return Current;
+	}
+	return NewObject<UObject>(this, Class, NAME_None, RF_Transient);
+}
+
+void AAgent::MarkBakedAssetDirty(UObject* Asset) const
+{
+#if WITH_EDITOR
+	if (!GetWorld()->IsGameWorld())
+	{
+		Asset->MarkPackageDirty();
+	}
+#endif
+}
+
+void AAgent::SpawnBoid(const FVector& Location, const FRotator& Rotation, uint8 ProfileIndex)
+{
+	if (IsReplicatedProxy())
+	{
+		UE_LOG(LogFlockAI, Warning, TEXT("Agent %s is replicated, its boids can only be spawned by the server"), *GetName());
+		return;
+	}
+
+	FFlockCommand Command;
+	Command.Type = EFlockCommandType::SpawnBoid;
+	Command.Location = Location;
+	Command.Rotation = Rotation;
+	Command.ProfileIndex = ProfileIndex;
+	Commands.Enqueue(MoveTemp(Command));
+}
+
+UBoid* AAgent::CreateBoid(const FVector& Location, const FRotator& Rotation, uint8 ProfileIndex, int32 BoidId)
 {
 	check(BoidBP);
-	
+
+	LLM_SCOPE_BYTAG(FlockAI_Boids);
+	CreateRenderAdapter();
+
 	//Create new instanced mesh in location and rotation
-	const int32 MeshInstanceIndex = HierarchicalInstancedStaticMeshComponent->AddInstance(
-		FTransform(Rotation.Quaternion(), Location, FVector::OneVector));
+	const int32 MeshInstanceIndex = RenderAdapter.IsValid()
+		? RenderAdapter->AddInstance(FTransform(Rotation.Quaternion(), Location, FVector::OneVector))
+		: INDEX_NONE;
 	UBoid* Boid = NewObject<UBoid>(this, BoidBP);
-	Boid->Init(Location, Rotation, MeshInstanceIndex);
+	Boid->Init(ToLocal(Location), Rotation, MeshInstanceIndex);
+	Boid->ProfileIndex = ProfileIndex;
+	Boid->BoidId = BoidId != INDEX_NONE ? BoidId : ++NextBoidId;
+	Boid->FlockSlot = Boids.Add(Boid);
+	BoidsById.Add(Boid->BoidId, Boid);
+	bNeighbourListsDirty = true;
+	return Boid;
+}
+
+void AAgent::CreateRenderAdapter()
+{
+	if (!RenderAdapter.IsValid() && !IsHeadless())
+	{
+		RenderAdapter = IFlockRenderAdapter::Create(RenderBackend, HierarchicalInstancedStaticMeshComponent, RenderChunkSize,
+													bWriteAnimationCustomData ? FlockAgent::NumAnimationCustomData : 0);
+	}
+}
+
+void AAgent::ReserveBoids(int32 NumBoids)
+{
+	LLM_SCOPE_BYTAG(FlockAI);
+	Boids.Reserve(NumBoids);
+
+	{
+		LLM_SCOPE_BYTAG(FlockAI_Spatial);
+		FlockLocations.Reserve(NumBoids);
+		FlockHeadings.Reserve(NumBoids);
+		FlockBoidIds.Reserve(NumBoids);
+		FlockOctree.Reserve(NumBoids);
+		for (TArray<FVector3f>& Forces : BehaviourForces)
+		{
+			Forces.Reserve(NumBoids);
+		}
+	}
+
+	{
+		LLM_SCOPE_BYTAG(FlockAI_Replication);
+		if (ShouldReplicateFlock())
+		{
+			ReplicatedFlock.Items.Reserve(NumBoids);
+			ReplicatedItemIndices.Reserve(NumBoids);
+		}
+	}
+	BoidsById.Reserve(NumBoids);
+
+	CreateRenderAdapter();
+	if (RenderAdapter.IsValid())
+	{
+		RenderAdapter->Reserve(NumBoids);
+	}
+}
+
+FFlockMemoryStats AAgent::GetMemoryStats() const
+{
+	FFlockMemoryStats Stats;
+	Stats.BoidBytes = Boids.GetAllocatedSize() + PendingBoidRemovals.GetAllocatedSize() + HibernatedFlocks.GetAllocatedSize() + UnloadedCellTimes.GetAllocatedSize()
+		+ SettingsOverrides.GetAllocatedSize() + SettingsOverrides.Num() * sizeof(FFlockBoidSettings);
+	for (const UBoid* Boid : Boids)
+	{
+		Stats.BoidBytes += Boid->GetAllocatedSize();
+	}
+	for (const FFlockHibernationSummary& Summary : HibernatedFlocks)
+	{
+		Stats.BoidBytes += Summary.CellCounts.GetAllocatedSize() + Summary.ProfileCounts.GetAllocatedSize();
+	}
+
+	Stats.SpatialBytes = FlockOctree.GetAllocatedSize() + FlockLocations.GetAllocatedSize() + FlockHeadings.GetAllocatedSize() + FlockBoidIds.GetAllocatedSize()
+		+ StimulusField.GetAllocatedSize() + BehaviourForces.GetAllocatedSize() + ViewFrustums.GetAllocatedSize() + Statistics.GetAllocatedSize()
+		+ StatisticsScratch.GetAllocatedSize() + PairSumsContexts.GetAllocatedSize();
+	for (const TArray<FVector3f>& Forces : BehaviourForces)
 	{
-		FScopeLock ScopeLock(&MutexBoid);
-		Boids.Add(MeshInstanceIndex, Boid);
+		Stats.SpatialBytes += Forces.GetAllocatedSize();
 	}
+	for (const FFlockPairSumsContext& Context : PairSumsContexts)
+	{
+		Stats.SpatialBytes += Context.GetAllocatedSize();
+	}
+
+	Stats.RenderBytes = (RenderAdapter.IsValid() ? RenderAdapter->GetAllocatedSize() : 0)
+		+ (ImpostorAdapter.IsValid() ? ImpostorAdapter->GetAllocatedSize() : 0)
+		+ ImpostorHandles.GetAllocatedSize() + ImpostorClusters.GetAllocatedSize() + ImpostorSlots.GetAllocatedSize();
+	Stats.BoidBytes += BoidsById.GetAllocatedSize();
+	Stats.ReplicationBytes = ReplicatedFlock.Items.GetAllocatedSize() + ReplicatedItemIndices.GetAllocatedSize();
+	Stats.NavigationBytes = (DistanceField != nullptr ? DistanceField->GetAllocatedSize() : 0)
+		+ (FlowField != nullptr ? FlowField->GetAllocatedSize() : 0);
+	Stats.TotalBytes = Stats.BoidBytes + Stats.SpatialBytes + Stats.RenderBytes + Stats.ReplicationBytes + Stats.NavigationBytes;
+	Stats.BytesPerBoid = Boids.Num() > 0 ? static_cast<float>(static_cast<double>(Stats.TotalBytes) / Boids.Num()) : 0.0f;
+	return Stats;
+}
+
+void AAgent::QueryBoids(const FFlockSpatialQuery& Query, TArray<FFlockBoidHandle>& OutBoids) const
+{
+	TArray<int32> Slots;
+	RunQuery(Query, Slots, OutBoids);
+}
+
+void AAgent::QueryBoidsBatch(const TArray<FFlockSpatialQuery>& Queries, TArray<FFlockSpatialQueryResult>& OutResults) const
+{
+	OutResults.SetNum(Queries.Num());
+	const int32 NumTasks = FMath::DivideAndRoundUp(Queries.Num(), FlockAgent::QueriesPerTask);
+	ParallelFor(NumTasks, [this, &Queries, &OutResults](int32 Task)
+	{
+		TArray<int32> Slots;
+		const int32 End = FMath::Min((Task + 1) * FlockAgent::QueriesPerTask, Queries.Num());
+		for (int32 Index = Task * FlockAgent::QueriesPerTask; Index < End; ++Index)
+		{
+			RunQuery(Queries[Index], Slots, OutResults[Index].Boids);
+		}
+	}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void AAgent::RunQuery(const FFlockSpatialQuery& Query, TArray<int32>& Slots, TArray<FFlockBoidHandle>& OutBoids) const
+{
+	Slots.Reset();
+	OutBoids.Reset();
+	const FVector3f Origin = ToLocal(Query.Origin);
+	switch (Query.Shape)
+	{
+	case EFlockQueryShape::Sphere:
+		FlockOctree.QuerySphere(Origin, Query.Radius, Slots);
+		break;
+	case EFlockQueryShape::Cone:
+		{
+			FlockOctree.QuerySphere(Origin, Query.Radius, Slots);
+			const FVector3f Axis = FVector3f(Query.Direction.GetSafeNormal());
+			const float CosHalfAngle = FMath::Cos(FMath::DegreesToRadians(FMath::Clamp(Query.HalfAngle, 0.0f, 180.0f)));
+			Slots.RemoveAllSwap([this, &Origin, &Axis, CosHalfAngle](int32 Slot)
+			{
+				const FVector3f Offset = FlockLocations[Slot] - Origin;
+				return FVector3f::DotProduct(Offset, Axis) < CosHalfAngle * Offset.Size();
+			}, false);
+		}
+		break;
+	case EFlockQueryShape::Box:
+		FlockOctree.QueryBox(FBox3f(Origin - FVector3f(Query.Extent), Origin + FVector3f(Query.Extent)), Slots);
+		break;
+	case EFlockQueryShape::Nearest:
+		// The removed boids are skipped by the search so they do not take the place of the K nearest
+		FlockOctree.QueryNearest(Origin, Query.MaxResults > 0 ? Query.MaxResults : MAX_int32,
+								 Query.Radius > 0.0f ? Query.Radius : TNumericLimits<float>::Max(), Slots,
+								 [this](int32 Slot) { return BoidsById.Contains(FlockBoidIds[Slot]); });
+		break;
+	}
+
+	// The boids removed since the octree was built are skipped
+	const int32 MaxResults = Query.MaxResults > 0 ? Query.MaxResults : MAX_int32;
+	OutBoids.Reserve(FMath::Min(Slots.Num(), MaxResults));
+	for (int32 Index = 0; Index < Slots.Num() && OutBoids.Num() < MaxResults; ++Index)
+	{
+		const int32 BoidId = FlockBoidIds[Slots[Index]];
+		if (BoidsById.Contains(BoidId))
+		{
+			OutBoids.Emplace(BoidId);
+		}
+	}
+}
+
+UBoid* AAgent::ResolveBoid(FFlockBoidHandle Handle) const
+{
+	UBoid* const* Boid = BoidsById.Find(Handle.BoidId);
+	return Boid != nullptr && IsValid(*Boid) && (*Boid)->FlockSlot != INDEX_NONE ? *Boid : nullptr;
 }
 
 void AAgent::RemoveBoid(UBoid* Boid)
 {
 	if (IsValid(Boid))
 	{
-		FScopeLock ScopeLock(&MutexBoid);
-		PendingBoidRemovals.Add(Boid->MeshIndex);
+		FFlockCommand Command;
+		Command.Type = EFlockCommandType::RemoveBoid;
+		Command.Object = Boid;
+		Commands.Enqueue(MoveTemp(Command));
+	}
+}
+
+void AAgent::AddBehaviourModule(UFlockBehaviourModule* Module)
+{
+	if (!IsValid(Module))
+	{
+		return;
+	}
+
+	if (Module->GetOuter() != this)
+	{
+		Module->Rename(nullptr, this, REN_DontCreateRedirectors | REN_NonTransactional);
+	}
+	BehaviourModules.AddUnique(Module);
+}
+
+void AAgent::RemoveBehaviourModule(UFlockBehaviourModule* Module)
+{
+	BehaviourModules.Remove(Module);
+}
+
+const FFlockBoidSettings& AAgent::GetBoidSettings(const UBoid* Boid) const
+{
+	check(Boid);
+	if (Boid->SettingsOverrideIndex != INDEX_NONE)
+	{
+		return *SettingsOverrides[Boid->SettingsOverrideIndex];
+	}
+
+	if (Profiles.IsValidIndex(Boid->ProfileIndex) && IsValid(Profiles[Boid->ProfileIndex]))
+	{
+		return Profiles[Boid->ProfileIndex]->Settings;
+	}
+
+	return DefaultSettings;
+}
+
+void AAgent::SetBoidSettingsOverride(UBoid* Boid, const FFlockBoidSettings& Settings)
+{
+	if (!IsValid(Boid))
+	{
+		return;
+	}
+
+	if (Boid->SettingsOverrideIndex != INDEX_NONE)
+	{
+		*SettingsOverrides[Boid->SettingsOverrideIndex] = Settings;
+		return;
+	}
+
+	Boid->SettingsOverrideIndex = SettingsOverrides.Add(MakeUnique<FFlockBoidSettings>(Settings));
+}
+
+void AAgent::ClearBoidSettingsOverride(UBoid* Boid)
+{
+	if (IsValid(Boid) && Boid->SettingsOverrideIndex != INDEX_NONE)
+	{
+		SettingsOverrides.RemoveAt(Boid->SettingsOverrideIndex);
+		Boid->SettingsOverrideIndex = INDEX_NONE;
 	}
 }
 
@@ -42,114 +510,1161 @@ void AAgent::AddGlobalStimulus(AStimulus* Stimulus)
 {
 	if (IsValid(Stimulus))
 	{
-		GlobalStimuli.AddUnique(Stimulus);
+		FFlockCommand Command;
+		Command.Type = EFlockCommandType::AddGlobalStimulus;
+		Command.Object = Stimulus;
+		Commands.Enqueue(MoveTemp(Command));
 	}
 }
 
 void AAgent::RemoveGlobalStimulus(AStimulus* Stimulus)
 {
-	GlobalStimuli.Remove(Stimulus);
-	for (const TTuple<int, UBoid*>& PairBoid : Boids)
+	if (Stimulus != nullptr)
 	{
-		check(IsValid(PairBoid.Value));
-		PairBoid.Value->RemovePrivateGlobalStimulus(Stimulus);
+		FFlockCommand Command;
+		Command.Type = EFlockCommandType::RemoveGlobalStimulus;
+		Command.Object = Stimulus;
+		Commands.Enqueue(MoveTemp(Command));
 	}
 }
 
 void AAgent::UpdateBoidNeighbourhood(UBoid* Boid)
 {
-	check(HierarchicalInstancedStaticMeshComponent);
 	check(Boid);
-	TArray<int32> OverlappingInstances =
-		HierarchicalInstancedStaticMeshComponent->GetInstancesOverlappingSphere(
-			Boid->Transform.GetLocation(), Boid->VisionRadius, false);
+	const FFlockBoidSettings& BoidSettings = GetBoidSettings(Boid);
+	const float VisionRadiusSquared = FMath::Square(BoidSettings.VisionRadius);
 
 	Boid->Neighbourhood.Empty(Boid->Neighbourhood.Num());
+	FFlockNeighbourSums& Sums = Boid->NeighbourSums;
+	Sums = FFlockNeighbourSums();
 
-	for (const int32& Index : OverlappingInstances)
+	// The candidates are a superset of the neighbourhood until the list is rebuilt, only the exact radius is left to test
+	for (UBoid* Candidate : Boid->NeighbourCandidates)
 	{
-		if (Boid->MeshIndex == Index)
+		if (!IsValid(Candidate))
 		{
 			continue;
 		}
-		UBoid** OverlappingBoid = Boids.Find(Index);
-		if (OverlappingBoid != nullptr && IsValid(*OverlappingBoid))
+
+		const FVector3f Offset = Candidate->LocalLocation - Boid->LocalLocation;
+		if (Offset.SizeSquared() > VisionRadiusSquared)
 		{
-			Boid->Neighbourhood.Add(*OverlappingBoid);
+			continue;
 		}
+
+		Boid->Neighbourhood.Add(Candidate);
+		++Sums.Count;
+		Sums.HeadingSum += Candidate->GetCurrentMoveVector().GetSafeNormal(UBoid::DefaultNormalizeVectorTolerance);
+		Sums.CohesionSum += Offset;
+		Sums.SeparationSum -= Offset.GetSafeNormal(UBoid::DefaultNormalizeVectorTolerance)
+			/ FMath::Abs(Offset.Size() - BoidSettings.BoidPhysicalRadius);
 	}
 }
 
-void AAgent::UpdateBoids(float DeltaTime)
+void AAgent::UpdateNeighbourLists()
 {
-	FScopeLock ScopeLock(&MutexBoid);
-	const int32 LastKey = Boids.end().Key();
-	
-	for (const TTuple<int, UBoid*>& PairBoid : Boids)
+	LLM_SCOPE_BYTAG(FlockAI_Spatial);
+	float MinSkin = TNumericLimits<float>::Max();
+	float MaxQueryRadius = 0.0f;
+	for (const UBoid* Boid : Boids)
 	{
-		UBoid* Boid = PairBoid.Value;
-		UpdateBoidNeighbourhood(Boid);
-		Boid->Update(DeltaTime, this);
+		const FFlockBoidSettings& BoidSettings = GetBoidSettings(Boid);
+		MinSkin = FMath::Min(MinSkin, BoidSettings.NeighbourSkinDistance);
+		MaxQueryRadius = FMath::Max(MaxQueryRadius, BoidSettings.VisionRadius + BoidSettings.NeighbourSkinDistance);
+	}
 
-		HierarchicalInstancedStaticMeshComponent->UpdateInstanceTransform(
-			Boid->MeshIndex,
-			Boid->Transform,
-			PairBoid.Key == LastKey
-		);
+	// A pair can only get closer by the displacement of both boids, lists built with a skin S stay valid
+	// while no boid has moved more than S / 2
+	const float HalfSkinSquared = FMath::Square(MinSkin * 0.5f);
+	bool bRebuild = bNeighbourListsDirty || bNeighbourListsSymmetric != bUseSymmetricPairForces;
+	for (int32 Slot = 0; Slot < Boids.Num() && !bRebuild; ++Slot)
+	{
+		const UBoid* Boid = Boids[Slot];
+		bRebuild = FVector3f::DistSquared(Boid->LocalLocation, Boid->NeighbourListLocation) > HalfSkinSquared;
 	}
-}
 
-void AAgent::ApplyPendingBoidRemovals()
-{
-	if (PendingBoidRemovals.IsEmpty())
+	if (!bRebuild)
 	{
 		return;
 	}
 
-	FScopeLock ScopeLock(&MutexBoid);
-	PendingBoidRemovals.Sort();
+	TArray<int32> CandidateSlots;
+	for (int32 Slot = 0; Slot < Boids.Num(); ++Slot)
+	{
+		UBoid* Boid = Boids[Slot];
+		const FFlockBoidSettings& BoidSettings = GetBoidSettings(Boid);
+		const float QueryRadius = bUseSymmetricPairForces
+			? MaxQueryRadius
+			: BoidSettings.VisionRadius + BoidSettings.NeighbourSkinDistance;
+		CandidateSlots.Reset();
+		FlockOctree.QuerySphere(Boid->LocalLocation, QueryRadius, CandidateSlots);
+
+		Boid->NeighbourCandidates.Reset(CandidateSlots.Num());
+		for (const int32 CandidateSlot : CandidateSlots)
+		{
+			if (CandidateSlot != Slot)
+			{
+				Boid->NeighbourCandidates.Add(Boids[CandidateSlot]);
+			}
+		}
+		Boid->NeighbourListLocation = Boid->LocalLocation;
+	}
+
+	bNeighbourListsDirty = false;
+	bNeighbourListsSymmetric = bUseSymmetricPairForces;
+}
+
+void AAgent::AccumulatePairNeighbourSums()
+{
+	const int32 NumSlots = Boids.Num();
+	TArray<float> VisionRadiiSquared;
+	TArray<float> PhysicalRadii;
+	VisionRadiiSquared.SetNumUninitialized(NumSlots);
+	PhysicalRadii.SetNumUninitialized(NumSlots);
+	for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+	{
+		const FFlockBoidSettings& BoidSettings = GetBoidSettings(Boids[Slot]);
+		VisionRadiiSquared[Slot] = FMath::Square(BoidSettings.VisionRadius);
+		PhysicalRadii[Slot] = BoidSettings.BoidPhysicalRadius;
+	}
 
-	for (int32 i = PendingBoidRemovals.Num() - 1; i >= 0; i--)
+	// Candidate lists are symmetric, the boid with the lowest slot owns the pair. Every task accumulates in its own
+	// context so both boids can be written without locks, the contexts are kept between updates and only the slots
+	// touched by a task are merged and zeroed again
+	if (PairSumsContexts.Num() == 0)
+	{
+		PairSumsContexts.SetNum(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1);
+	}
+	const int32 NumTasks = FMath::Clamp(FMath::DivideAndRoundUp(NumSlots, FlockAgent::PairSlotsPerTask), 1, PairSumsContexts.Num());
+	const int32 SlotsPerTask = FMath::DivideAndRoundUp(NumSlots, NumTasks);
+	ParallelFor(NumTasks, [this, NumSlots, SlotsPerTask, &VisionRadiiSquared, &PhysicalRadii](int32 Task)
 	{
-		const int32 MeshIndexToRemove = PendingBoidRemovals[i];
-		Boids.Remove(MeshIndexToRemove);
-		if (!HierarchicalInstancedStaticMeshComponent->RemoveInstance(MeshIndexToRemove))
+		FFlockPairSumsContext& Context = PairSumsContexts[Task];
+		if (Context.Sums.Num() < NumSlots)
 		{
-			break;
+			Context.Sums.AddZeroed(NumSlots - Context.Sums.Num());
 		}
 
-		// Update MeshIndex values for the remaining Boids
-		FTransform InstanceTransform;
-		if (HierarchicalInstancedStaticMeshComponent->GetInstanceTransform(MeshIndexToRemove, InstanceTransform, true))
+		auto TouchSums = [&Context](int32 Slot) -> FFlockNeighbourSums&
+		{
+			FFlockNeighbourSums& Sums = Context.Sums[Slot];
+			if (Sums.Count == 0)
+			{
+				Context.Touched.Add(Slot);
+			}
+			return Sums;
+		};
+
+		const int32 EndSlot = FMath::Min((Task + 1) * SlotsPerTask, NumSlots);
+		for (int32 Slot = Task * SlotsPerTask; Slot < EndSlot; ++Slot)
 		{
-			TMap<int32, UBoid*> UpdatedBoids;
-			for (const TTuple<int32, UBoid*>& PairBoid : Boids)
+			const FVector3f& Location = FlockLocations[Slot];
+			for (const UBoid* Candidate : Boids[Slot]->NeighbourCandidates)
 			{
-				if (IsValid(PairBoid.Value) && PairBoid.Value->Transform.Equals(InstanceTransform))
+				const int32 Other = Candidate->FlockSlot;
+				if (Other <= Slot)
 				{
-					PairBoid.Value->MeshIndex = MeshIndexToRemove;
-					UpdatedBoids.Add(MeshIndexToRemove, PairBoid.Value);
+					continue;
 				}
-				else
+
+				const FVector3f Offset = FlockLocations[Other] - Location;
+				const float DistanceSquared = Offset.SizeSquared();
+				const bool bSlotSeesOther = DistanceSquared <= VisionRadiiSquared[Slot];
+				const bool bOtherSeesSlot = DistanceSquared <= VisionRadiiSquared[Other];
+				if (!bSlotSeesOther && !bOtherSeesSlot)
+				{
+					continue;
+				}
+
+				// Distance and normal are shared by both boids
+				const float Distance = FMath::Sqrt(DistanceSquared);
+				const FVector3f Normal = DistanceSquared > UBoid::DefaultNormalizeVectorTolerance ? Offset / Distance : FVector3f::ZeroVector;
+				const float SlotInverseDistance = 1.0f / FMath::Abs(Distance - PhysicalRadii[Slot]);
+				if (bSlotSeesOther)
 				{
-					UpdatedBoids.Add(PairBoid.Key, PairBoid.Value);
+					FFlockNeighbourSums& Sums = TouchSums(Slot);
+					++Sums.Count;
+					Sums.HeadingSum += FlockHeadings[Other];
+					Sums.CohesionSum += Offset;
+					Sums.SeparationSum -= Normal * SlotInverseDistance;
+				}
+
+				if (bOtherSeesSlot)
+				{
+					const float OtherInverseDistance = PhysicalRadii[Other] == PhysicalRadii[Slot]
+						? SlotInverseDistance
+						: 1.0f / FMath::Abs(Distance - PhysicalRadii[Other]);
+					FFlockNeighbourSums& Sums = TouchSums(Other);
+					++Sums.Count;
+					Sums.HeadingSum += FlockHeadings[Slot];
+					Sums.CohesionSum -= Offset;
+					Sums.SeparationSum += Normal * OtherInverseDistance;
 				}
 			}
-			Boids = UpdatedBoids;
 		}
-	}
+	}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
 
-	PendingBoidRemovals.Empty();
+	ParallelFor(NumSlots, [this](int32 Slot)
+	{
+		UBoid* Boid = Boids[Slot];
+		Boid->NeighbourSums = FFlockNeighbourSums();
+		Boid->Neighbourhood.Reset();
+	});
+
+	for (FFlockPairSumsContext& Context : PairSumsContexts)
+	{
+		for (const int32 Slot : Context.Touched)
+		{
+			FFlockNeighbourSums& PairSums = Context.Sums[Slot];
+			FFlockNeighbourSums& Sums = Boids[Slot]->NeighbourSums;
+			Sums.Count += PairSums.Count;
+			Sums.HeadingSum += PairSums.HeadingSum;
+			Sums.CohesionSum += PairSums.CohesionSum;
+			Sums.SeparationSum += PairSums.SeparationSum;
+			PairSums = FFlockNeighbourSums();
+		}
+		Context.Touched.Reset();
+	}
 }
 
-void AAgent::Tick(float DeltaSeconds)
+void AAgent::BuildFlockOctree()
 {
-	Super::Tick(DeltaSeconds);
-	if (Boids.Num() == 0)
+	LLM_SCOPE_BYTAG(FlockAI_Spatial);
+	FlockLocations.Reset(Boids.Num());
+	FlockHeadings.Reset(Boids.Num());
+	FlockBoidIds.Reset(Boids.Num());
+	FBox3f Bounds(ForceInit);
+	for (const UBoid* Boid : Boids)
 	{
-		return;
+		FlockLocations.Add(Boid->LocalLocation);
+		FlockBoidIds.Add(Boid->BoidId);
+		FlockHeadings.Add(Boid->GetCurrentMoveVector().GetSafeNormal(UBoid::DefaultNormalizeVectorTolerance));
+		Bounds += Boid->LocalLocation;
 	}
 
-	UpdateBoids(DeltaSeconds);
-	ApplyPendingBoidRemovals();
+	FlockBounds = FBox(ToWorld(Bounds.Min), ToWorld(Bounds.Max));
+
+	// Keep the float32 locations close to zero where they are precise
+	const FVector3f FlockCenter = Bounds.GetCenter();
+	if (FlockCenter.SizeSquared() > FMath::Square(RebaseDistance))
+	{
+		RebaseSimulationOrigin(FlockCenter);
+		for (FVector3f& Location : FlockLocations)
+		{
+			Location -= FlockCenter;
+		}
+		Bounds = Bounds.ShiftBy(-FlockCenter);
+	}
+
+	FlockOctree.Build(FlockLocations, FlockHeadings);
+	if (bUpdateStatistics)
+	{
+		Statistics.Build(FlockLocations, FlockHeadings, Bounds, SimulationOrigin, StatisticsDensityResolution, StatisticsScratch);
+	}
+	else if (Statistics.NumBoids > 0)
+	{
+		Statistics.Reset();
+	}
+}
+
+void AAgent::UpdateStimulusField()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Spatial);
+	if (!bUseStimulusField)
+	{
+		if (StimulusField.IsBuilt())
+		{
+			StimulusField.Reset();
+		}
+		return;
+	}
+
+	// Consumable lists are built for the largest boid
+	float MaxPhysicalRadius = DefaultSettings.BoidPhysicalRadius;
+	for (const UFlockProfile* Profile : Profiles)
+	{
+		if (IsValid(Profile))
+		{
+			MaxPhysicalRadius = FMath::Max(MaxPhysicalRadius, Profile->Settings.BoidPhysicalRadius);
+		}
+	}
+	StimulusField.Update(GlobalStimuli, FlockBounds, StimulusFieldCellSize, DefaultSettings.BoidPhysicalRadius, 2.0f * MaxPhysicalRadius);
+}
+
+void AAgent::UpdateViewFrustums()
+{
+	ViewFrustums.Reset();
+	if (!bCheapOffscreenSimulation)
+	{
+		return;
+	}
+
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		const APlayerController* PlayerController = Iterator->Get();
+		if (PlayerController != nullptr && !PlayerController->IsLocalController() && ShouldReplicateFlock())
+		{
+			// The views of the remote players are not known on a listen server and they are sent the state of the
+			// boids, every boid is simulated fully while one watches the flock
+			ViewFrustums.Reset();
+			return;
+		}
+
+		ULocalPlayer* LocalPlayer = PlayerController != nullptr ? PlayerController->GetLocalPlayer() : nullptr;
+		if (LocalPlayer == nullptr || LocalPlayer->ViewportClient == nullptr || LocalPlayer->ViewportClient->Viewport == nullptr)
+		{
+			continue;
+		}
+
+		FSceneViewProjectionData ProjectionData;
+		if (LocalPlayer->GetProjectionData(LocalPlayer->ViewportClient->Viewport, ProjectionData))
+		{
+			GetViewFrustumBounds(ViewFrustums.AddDefaulted_GetRef(), ProjectionData.ComputeViewProjectionMatrix(), false);
+		}
+	}
+}
+
+bool AAgent::IsBoidInView(const UBoid* Boid) const
+{
+	const float Radius = GetBoidSettings(Boid).BoidPhysicalRadius + VisibilityMargin;
+	const FVector Location = ToWorld(Boid->LocalLocation);
+	const FVector RenderedLocation = ToWorld(Boid->RenderedLocation);
+	for (const FConvexVolume& Frustum : ViewFrustums)
+	{
+		// The stale instance must be moved out of the view before it can freeze
+		if (Frustum.IntersectSphere(Location, Radius) || Frustum.IntersectSphere(RenderedLocation, Radius))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void AAgent::RebaseSimulationOrigin(const FVector3f& NewLocalOrigin)
+{
+	SimulationOrigin += FVector(NewLocalOrigin);
+	for (UBoid* Boid : Boids)
+	{
+		Boid->LocalLocation -= NewLocalOrigin;
+		Boid->NeighbourListLocation -= NewLocalOrigin;
+		Boid->RenderedLocation -= NewLocalOrigin;
+		Boid->NetLocation -= NewLocalOrigin;
+	}
+}
+
+void AAgent::UpdateBoids(float DeltaTime)
+{
+	uint64 StageStart = FPlatformTime::Cycles64();
+	BuildFlockOctree();
+	UpdateViewFrustums();
+	UpdateStimulusField();
+	UpdateImpostors();
+	StageTimings.OctreeMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StageStart);
+
+	StageStart = FPlatformTime::Cycles64();
+	UpdateNeighbourLists();
+	if (bUseSymmetricPairForces)
+	{
+		AccumulatePairNeighbourSums();
+	}
+	uint64 NeighbourhoodCycles = FPlatformTime::Cycles64() - StageStart;
+
+	StageStart = FPlatformTime::Cycles64();
+	EvaluateBehaviourModules(DeltaTime);
+	uint64 SteeringCycles = FPlatformTime::Cycles64() - StageStart;
+	uint64 InstanceUploadCycles = 0;
+
+	// Update of every profile, the last one is for DefaultSettings
+	TArray<UBoid::FUpdatePipeline, TInlineAllocator<8>> ProfilePipelines;
+	if (bUseSpecialisedPipelines)
+	{
+		ProfilePipelines.SetNumUninitialized(Profiles.Num() + 1);
+		for (int32 Index = 0; Index < Profiles.Num(); ++Index)
+		{
+			ProfilePipelines[Index] = UBoid::GetUpdatePipeline((IsValid(Profiles[Index]) ? Profiles[Index]->Settings : DefaultSettings).GetFeatures());
+		}
+		ProfilePipelines.Last() = UBoid::GetUpdatePipeline(DefaultSettings.GetFeatures());
+	}
+
+	for (UBoid* Boid : Boids)
+	{
+		StageStart = FPlatformTime::Cycles64();
+		if (!bUseSymmetricPairForces)
+		{
+			UpdateBoidNeighbourhood(Boid);
+		}
+		const uint64 NeighbourhoodEnd = FPlatformTime::Cycles64();
+		Boid->bOffscreen = ViewFrustums.Num() > 0 && !IsBoidInView(Boid);
+		if (!bUseSpecialisedPipelines)
+		{
+			Boid->Update(DeltaTime, this);
+		}
+		else
+		{
+			const UBoid::FUpdatePipeline Pipeline = Boid->SettingsOverrideIndex != INDEX_NONE
+				? UBoid::GetUpdatePipeline(GetBoidSettings(Boid).GetFeatures())
+				: ProfilePipelines[FMath::Min<int32>(Boid->ProfileIndex, Profiles.Num())];
+			(Boid->*Pipeline)(DeltaTime, this);
+		}
+		const uint64 SteeringEnd = FPlatformTime::Cycles64();
+
+		// Only the instance transforms go back to world doubles. The instance of an off screen boid is left where
+		// it was last seen, the first visible update traces the floor again and snaps it
+		if (!Boid->bOffscreen && !Boid->bImpostor && RenderAdapter.IsValid())
+		{
+			SetBoidInstance(Boid);
+			Boid->RenderedLocation = Boid->LocalLocation;
+		}
+
+		NeighbourhoodCycles += NeighbourhoodEnd - StageStart;
+		SteeringCycles += SteeringEnd - NeighbourhoodEnd;
+		InstanceUploadCycles += FPlatformTime::Cycles64() - SteeringEnd;
+	}
+
+	if (RenderAdapter.IsValid())
+	{
+		StageStart = FPlatformTime::Cycles64();
+		RenderAdapter->Flush();
+		InstanceUploadCycles += FPlatformTime::Cycles64() - StageStart;
+	}
+
+#if UE_ENABLE_DEBUG_DRAWING
+	DrawFlockDebug();
+#endif
+
+	StageTimings.NeighbourhoodMs = FPlatformTime::ToMilliseconds64(NeighbourhoodCycles);
+	StageTimings.SteeringMs = FPlatformTime::ToMilliseconds64(SteeringCycles);
+	StageTimings.InstanceUploadMs = FPlatformTime::ToMilliseconds64(InstanceUploadCycles);
+}
+
+void AAgent::GetViewLocations(TArray<FVector, TInlineAllocator<8>>& OutLocations) const
+{
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		if (const APlayerController* PlayerController = Iterator->Get())
+		{
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			OutLocations.Add(ViewLocation);
+		}
+	}
+}
+
+void AAgent::UpdateImpostors()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Rendering);
+	TArray<FVector, TInlineAllocator<8>> ViewLocations;
+	if (bUseImpostors && RenderAdapter.IsValid())
+	{
+		GetViewLocations(ViewLocations);
+	}
+
+	TArray<FVector3f, TInlineAllocator<8>> Views;
+	for (const FVector& ViewLocation : ViewLocations)
+	{
+		Views.Add(ToLocal(ViewLocation));
+	}
+
+	ImpostorClusters.Reset();
+	const float BlendStart = FMath::Max(ImpostorDistance - ImpostorBlendDistance, 0.0f);
+	FlockOctree.CollectClusters(Views, BlendStart, ImpostorMaxCellAngle, ImpostorClusters);
+	if (ImpostorClusters.Num() > 0 && !ImpostorAdapter.IsValid())
+	{
+		ImpostorAdapter = IFlockRenderAdapter::Create(EFlockRenderBackend::InstancedStaticMesh, ImpostorMeshComponent, RenderChunkSize,
+													  FlockAgent::NumImpostorCustomData);
+	}
+
+	// One impostor per cluster in the blend, its boids give their instances away once it is fully grown
+	ImpostorSlots.Init(false, Boids.Num());
+	int32 NumImpostors = 0;
+	for (const int32 NodeIndex : ImpostorClusters)
+	{
+		const FFlockOctree::FNode& Node = FlockOctree.GetNode(NodeIndex);
+		if (Node.NumItems == 0)
+		{
+			continue;
+		}
+
+		float Distance = TNumericLimits<float>::Max();
+		for (const FVector3f& View : Views)
+		{
+			Distance = FMath::Min(Distance, FVector3f::Dist(View, Node.Centroid));
+		}
+
+		const float Fade = ImpostorBlendDistance > 0.0f
+			? FMath::Clamp((Distance - BlendStart) / ImpostorBlendDistance, 0.0f, 1.0f)
+			: (Distance >= ImpostorDistance ? 1.0f : 0.0f);
+		if (Fade <= 0.0f)
+		{
+			continue;
+		}
+
+		for (const int32 Slot : FlockOctree.GetNodeSlots(NodeIndex))
+		{
+			if (Fade >= (Boids[Slot]->bImpostor ? FlockAgent::ImpostorShowFade : 1.0f))
+			{
+				ImpostorSlots[Slot] = true;
+			}
+		}
+
+		const FVector3f Heading = Node.HeadingSum.GetSafeNormal(UBoid::DefaultNormalizeVectorTolerance, FVector3f::ForwardVector);
+		const FTransform Transform(
+			FRotationMatrix::MakeFromXZ(FVector(Heading), FVector::UpVector).ToQuat(),
+			ToWorld(Node.Centroid),
+			FVector(ImpostorScale * Fade * FMath::Pow(static_cast<float>(Node.NumItems), 1.0f / 3.0f)));
+		if (NumImpostors == ImpostorHandles.Num())
+		{
+			ImpostorHandles.Add(ImpostorAdapter->AddInstance(Transform));
+		}
+		else
+		{
+			ImpostorAdapter->SetInstanceTransform(ImpostorHandles[NumImpostors], Transform);
+		}
+		const float CustomData[FlockAgent::NumImpostorCustomData] = {Fade, static_cast<float>(Node.NumItems)};
+		ImpostorAdapter->SetInstanceCustomData(ImpostorHandles[NumImpostors], CustomData);
+		++NumImpostors;
+	}
+
+	while (ImpostorHandles.Num() > NumImpostors)
+	{
+		ImpostorAdapter->RemoveInstance(ImpostorHandles.Pop(false));
+	}
+	if (ImpostorAdapter.IsValid())
+	{
+		ImpostorAdapter->Flush();
+	}
+
+	// Swap the instances of the boids that crossed the end of the blend
+	for (UBoid* Boid : Boids)
+	{
+		const bool bImpostor = ImpostorSlots[Boid->FlockSlot];
+		if (bImpostor == Boid->bImpostor)
+		{
+			continue;
+		}
+
+		Boid->bImpostor = bImpostor;
+		if (bImpostor)
+		{
+			RenderAdapter->RemoveInstance(Boid->MeshIndex);
+			Boid->MeshIndex = INDEX_NONE;
+		}
+		else
+		{
+			Boid->MeshIndex = RenderAdapter->AddInstance(FTransform(FQuat(Boid->LocalRotation), ToWorld(Boid->LocalLocation)));
+			Boid->RenderedLocation = Boid->LocalLocation;
+		}
+	}
+}
+
+void AAgent::SetBoidInstance(const UBoid* Boid)
+{
+	RenderAdapter->SetInstanceTransform(Boid->MeshIndex, FTransform(FQuat(Boid->LocalRotation), ToWorld(Boid->LocalLocation)));
+	if (RenderAdapter->GetNumCustomData() == FlockAgent::NumAnimationCustomData)
+	{
+		const float CustomData[FlockAgent::NumAnimationCustomData] = {Boid->AnimationPhase, Boid->AnimationSpeed, Boid->AnimationTurnRate};
+		RenderAdapter->SetInstanceCustomData(Boid->MeshIndex, CustomData);
+	}
+}
+
+#if UE_ENABLE_DEBUG_DRAWING
+void AAgent::DrawFlockDebug() const
+{
+	ULineBatchComponent* LineBatcher = GetWorld()->PersistentLineBatcher;
+	const EFlockDebugComponents Components = static_cast<EFlockDebugComponents>(DebugDraw.Components);
+	if (LineBatcher == nullptr || Components == EFlockDebugComponents::None)
+	{
+		return;
+	}
+
+	// Nothing to sample unless some settings enable the debug view
+	bool bAnyEnabled = DefaultSettings.bEnableDebugDraw;
+	for (const UFlockProfile* Profile : Profiles)
+	{
+		bAnyEnabled |= IsValid(Profile) && Profile->Settings.bEnableDebugDraw;
+	}
+	for (const TUniquePtr<FFlockBoidSettings>& Override : SettingsOverrides)
+	{
+		bAnyEnabled |= Override->bEnableDebugDraw;
+	}
+	if (!bAnyEnabled)
+	{
+		return;
+	}
+
+	// Candidates are every boid, or the boids around the focus
+	TArray<int32> FocusSlots;
+	FVector Focus;
+	const bool bUseFocus = DebugDraw.FocusRadius > 0.0f;
+	if (bUseFocus)
+	{
+		if (!GetDebugFocus(Focus))
+		{
+			return;
+		}
+		FlockOctree.QuerySphere(ToLocal(Focus), DebugDraw.FocusRadius, FocusSlots);
+		FocusSlots.Sort();
+	}
+
+	const int32 NumCandidates = bUseFocus ? FocusSlots.Num() : Boids.Num();
+	const int32 Stride = FMath::Max(DebugDraw.Stride, 1);
+	const float Thickness = DebugDraw.Thickness;
+	TArray<FBatchedLine> Lines;
+	Lines.Reserve(FMath::Min(DebugDraw.MaxBoids, NumCandidates) * 4);
+
+	auto AddLine = [&Lines, Thickness, Components](EFlockDebugComponents Component, const FVector& Start, const FVector3f& Vector,
+												   const FColor& Color, float LifeTime)
+	{
+		if (EnumHasAnyFlags(Components, Component) && !Vector.IsNearlyZero())
+		{
+			Lines.Emplace(Start, Start + FVector(Vector), FLinearColor(Color), LifeTime, Thickness, SDPG_World);
+		}
+	};
+
+	int32 NumDrawn = 0;
+	for (int32 Candidate = 0; Candidate < NumCandidates && NumDrawn < DebugDraw.MaxBoids; Candidate += Stride)
+	{
+		const int32 Slot = bUseFocus ? FocusSlots[Candidate] : Candidate;
+		if (!Boids.IsValidIndex(Slot))
+		{
+			continue;
+		}
+
+		const UBoid* Boid = Boids[Slot];
+		const FFlockBoidSettings& Settings = GetBoidSettings(Boid);
+		if (!Settings.bEnableDebugDraw)
+		{
+			continue;
+		}
+		++NumDrawn;
+
+		const FVector Location = ToWorld(Boid->LocalLocation);
+		const float LifeTime = Settings.DebugRayDuration;
+		AddLine(EFlockDebugComponents::Velocity, Location, Boid->GetCurrentMoveVector() * 300.0f, FColor::Green, LifeTime);
+		AddLine(EFlockDebugComponents::Alignment, Location, Boid->AlignmentComponent * Settings.AlignmentWeight * 100.0f, FColor::Purple, LifeTime);
+		AddLine(EFlockDebugComponents::Cohesion, Location, Boid->CohesionComponent * Settings.CohesionWeight * 100.0f, FColor::Orange, LifeTime);
+		AddLine(EFlockDebugComponents::Separation, Location, Boid->SeparationComponent * Settings.SeparationWeight * 100.0f, FColor::Blue, LifeTime);
+		AddLine(EFlockDebugComponents::Stimuli, Location, Boid->PositiveStimuliComponent * 100.0f, FColor::Cyan, LifeTime);
+		AddLine(EFlockDebugComponents::Stimuli, Location, Boid->NegativeStimuliComponent * 100.0f, FColor::Magenta, LifeTime);
+		AddLine(EFlockDebugComponents::Collision, Location, Boid->CollisionComponent * Settings.CollisionWeight * 100.0f, FColor::Red, LifeTime);
+		AddLine(EFlockDebugComponents::Behaviour, Location, Boid->BehaviourComponent * 100.0f, FColor::Yellow, LifeTime);
+		if (Settings.bFollowFloorZ && Settings.FloorRayDuration > 0.0f)
+		{
+			AddLine(EFlockDebugComponents::Floor, Location, FVector3f(0.0f, 0.0f, -Settings.FloorHeightOffset), FColor::White, Settings.FloorRayDuration);
+		}
+	}
+
+	if (Lines.Num() > 0)
+	{
+		LineBatcher->DrawLines(Lines);
+	}
+}
+
+bool AAgent::GetDebugFocus(FVector& OutLocation) const
+{
+	const APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
+	if (PlayerController == nullptr || !PlayerController->IsLocalController())
+	{
+		return false;
+	}
+
+	FHitResult Hit;
+	if (PlayerController->bShowMouseCursor && PlayerController->GetHitResultUnderCursor(ECC_Visibility, false, Hit))
+	{
+		OutLocation = Hit.Location;
+		return true;
+	}
+
+	// The point looked at, or the view location when looking at nothing
+	FVector ViewLocation;
+	FRotator ViewRotation;
+	PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+	static const FName DebugFocusName(TEXT("FlockDebugFocus"));
+	const FCollisionQueryParams Params(DebugFocusName, false, this);
+	OutLocation = GetWorld()->LineTraceSingleByChannel(Hit, ViewLocation, ViewLocation + ViewRotation.Vector() * WORLD_MAX, ECC_Visibility, Params)
+		? Hit.Location
+		: ViewLocation;
+	return true;
+}
+#endif
+
+void AAgent::EvaluateBehaviourModules(float DeltaTime)
+{
+	LLM_SCOPE_BYTAG(FlockAI_Spatial);
+	TArray<UFlockBehaviourModule*, TInlineAllocator<8>> ActiveModules;
+	for (UFlockBehaviourModule* Module : BehaviourModules)
+	{
+		if (IsValid(Module) && Module->bEnabled && Module->Weight != 0.0f)
+		{
+			ActiveModules.Add(Module);
+		}
+	}
+
+	if (ActiveModules.Num() == 0)
+	{
+		if (bHasBehaviourForces)
+		{
+			for (UBoid* Boid : Boids)
+			{
+				Boid->BehaviourComponent = FVector3f::ZeroVector;
+			}
+			bHasBehaviourForces = false;
+		}
+		return;
+	}
+	bHasBehaviourForces = true;
+
+	FFlockBehaviourContext Context;
+	Context.Agent = this;
+	Context.Locations = FlockLocations;
+	Context.Headings = FlockHeadings;
+	Context.DeltaSeconds = DeltaTime;
+	Context.TimeSeconds = GetWorld()->GetTimeSeconds();
+	for (UFlockBehaviourModule* Module : ActiveModules)
+	{
+		Module->PrepareEvaluation(Context);
+	}
+
+	const int32 NumSlots = Boids.Num();
+	BehaviourForces.SetNum(ActiveModules.Num());
+	for (TArray<FVector3f>& Forces : BehaviourForces)
+	{
+		Forces.SetNumUninitialized(NumSlots, false);
+	}
+
+	// The blocks of every module in a single parallel pass, then the weighted sum of the streams
+	const int32 BlockSize = FlockAgent::BehaviourBlockSize;
+	const int32 NumBlocks = FMath::DivideAndRoundUp(NumSlots, BlockSize);
+	ParallelFor(ActiveModules.Num() * NumBlocks, [this, &ActiveModules, &Context, NumBlocks, NumSlots, BlockSize](int32 Task)
+	{
+		const int32 ModuleIndex = Task / NumBlocks;
+		const int32 Begin = (Task % NumBlocks) * BlockSize;
+		ActiveModules[ModuleIndex]->Evaluate(Context, Begin, FMath::Min(Begin + BlockSize, NumSlots), BehaviourForces[ModuleIndex]);
+	});
+
+	ParallelFor(NumBlocks, [this, &ActiveModules, NumSlots, BlockSize](int32 Block)
+	{
+		const int32 Begin = Block * BlockSize;
+		const int32 End = FMath::Min(Begin + BlockSize, NumSlots);
+		for (int32 Slot = Begin; Slot < End; ++Slot)
+		{
+			FVector3f Force = FVector3f::ZeroVector;
+			for (int32 ModuleIndex = 0; ModuleIndex < ActiveModules.Num(); ++ModuleIndex)
+			{
+				Force += BehaviourForces[ModuleIndex][Slot] * ActiveModules[ModuleIndex]->Weight;
+			}
+			Boids[Slot]->BehaviourComponent = Force;
+		}
+	});
+}
+
+void AAgent::ApplyPendingBoidRemovals()
+{
+	if (PendingBoidRemovals.IsEmpty())
+	{
+		return;
+	}
+
+	for (UBoid* Boid : PendingBoidRemovals)
+	{
+		if (!IsValid(Boid) || !Boids.IsValidIndex(Boid->FlockSlot) || Boids[Boid->FlockSlot] != Boid)
+		{
+			continue;
+		}
+
+		ClearBoidSettingsOverride(Boid);
+		BoidsById.Remove(Boid->BoidId);
+
+		int32 ItemIndex = INDEX_NONE;
+		if (ReplicatedItemIndices.RemoveAndCopyValue(Boid->BoidId, ItemIndex))
+		{
+			ReplicatedFlock.Items.RemoveAtSwap(ItemIndex, 1, false);
+			if (ReplicatedFlock.Items.IsValidIndex(ItemIndex))
+			{
+				ReplicatedItemIndices.Add(static_cast<int32>(ReplicatedFlock.Items[ItemIndex].BoidId), ItemIndex);
+			}
+			ReplicatedFlock.MarkArrayDirty();
+		}
+
+		if (RenderAdapter.IsValid())
+		{
+			RenderAdapter->RemoveInstance(Boid->MeshIndex);
+		}
+
+		// Keep the boids packed, the last one takes the slot of the removed one
+		const int32 Slot = Boid->FlockSlot;
+		Boids.RemoveAtSwap(Slot, 1, false);
+		if (Boids.IsValidIndex(Slot))
+		{
+			Boids[Slot]->FlockSlot = Slot;
+		}
+		Boid->FlockSlot = INDEX_NONE;
+		Boid->MeshIndex = INDEX_NONE;
+		bNeighbourListsDirty = true;
+	}
+
+	PendingBoidRemovals.Empty();
+}
+
+void AAgent::ApplyCommands()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Boids);
+	bool bStimuliRemoved = false;
+	FFlockCommand Command;
+	while (Commands.Dequeue(Command))
+	{
+		switch (Command.Type)
+		{
+		case EFlockCommandType::SpawnBoid:
+			{
+				UBoid* Boid = CreateBoid(Command.Location, Command.Rotation, Command.ProfileIndex);
+				if (ShouldReplicateFlock())
+				{
+					LLM_SCOPE_BYTAG(FlockAI_Replication);
+					FFlockReplicatedBoid& Item = ReplicatedFlock.Items.AddDefaulted_GetRef();
+					Item.BoidId = static_cast<uint32>(Boid->BoidId);
+					Item.ProfileIndex = Command.ProfileIndex;
+					Item.Pack(Command.Location, FVector3f(Command.Rotation.Vector()), GetWorld()->GetTimeSeconds());
+					ReplicatedFlock.MarkItemDirty(Item);
+					ReplicatedItemIndices.Add(Boid->BoidId, ReplicatedFlock.Items.Num() - 1);
+				}
+				break;
+			}
+		case EFlockCommandType::RemoveBoid:
+			if (UBoid* Boid = Cast<UBoid>(Command.Object.Get()))
+			{
+				PendingBoidRemovals.AddUnique(Boid);
+			}
+			break;
+		case EFlockCommandType::AddGlobalStimulus:
+			if (AStimulus* Stimulus = Cast<AStimulus>(Command.Object.Get()))
+			{
+				GlobalStimuli.AddUnique(Stimulus);
+			}
+			break;
+		case EFlockCommandType::RemoveGlobalStimulus:
+			{
+				// A stimulus is usually destroyed right after it is removed
+				AStimulus* Stimulus = Cast<AStimulus>(Command.Object.Get(true));
+				GlobalStimuli.Remove(Stimulus);
+				for (UBoid* Boid : Boids)
+				{
+					check(IsValid(Boid));
+					Boid->RemovePrivateGlobalStimulus(Stimulus);
+				}
+				bStimuliRemoved = true;
+				break;
+			}
+		}
+	}
+
+	// The stimuli collected before their removal was applied are nulled in the array by the garbage collector
+	if (bStimuliRemoved)
+	{
+		GlobalStimuli.RemoveAll([](const AStimulus* Stimulus) { return !IsValid(Stimulus); });
+	}
+
+	ApplyPendingBoidRemovals();
+}
+
+void AAgent::UpdateProxyBoids(float DeltaTime)
+{
+	uint64 StageStart = FPlatformTime::Cycles64();
+	BuildFlockOctree();
+	UpdateImpostors();
+	StageTimings.OctreeMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StageStart);
+
+	StageStart = FPlatformTime::Cycles64();
+	for (UBoid* Boid : Boids)
+	{
+		Boid->UpdateProxy(DeltaTime, ProxySmoothingSpeed, this);
+	}
+	const uint64 SteeringEnd = FPlatformTime::Cycles64();
+
+	if (RenderAdapter.IsValid())
+	{
+		for (UBoid* Boid : Boids)
+		{
+			if (!Boid->bImpostor)
+			{
+				SetBoidInstance(Boid);
+				Boid->RenderedLocation = Boid->LocalLocation;
+			}
+		}
+		RenderAdapter->Flush();
+	}
+
+	StageTimings.NeighbourhoodMs = 0.0f;
+	StageTimings.SteeringMs = FPlatformTime::ToMilliseconds64(SteeringEnd - StageStart);
+	StageTimings.InstanceUploadMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - SteeringEnd);
+}
+
+void AAgent::UpdateReplicatedFlock()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Replication);
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Now < NextReplicationTime)
+	{
+		return;
+	}
+	NextReplicationTime = Now + 1.0 / FMath::Max(NetUpdateFrequency, 1.0f);
+
+	TArray<FVector, TInlineAllocator<8>> ViewLocations;
+	GetViewLocations(ViewLocations);
+
+	// Error of every boid against where the clients extrapolate it, in thresholds, divided by the distance to the closest player
+	const float CosHeadingThreshold = FMath::Cos(FMath::DegreesToRadians(ReplicationHeadingThreshold));
+	const float DistanceThreshold = FMath::Max(ReplicationDistanceThreshold, UE_KINDA_SMALL_NUMBER);
+	TArray<TPair<float, int32>> Candidates;
+	for (int32 Slot = 0; Slot < Boids.Num(); ++Slot)
+	{
+		const UBoid* Boid = Boids[Slot];
+		const int32* ItemIndex = ReplicatedItemIndices.Find(Boid->BoidId);
+		if (ItemIndex == nullptr)
+		{
+			continue;
+		}
+
+		const FFlockReplicatedBoid& Item = ReplicatedFlock.Items[*ItemIndex];
+		const FVector Location = ToWorld(Boid->LocalLocation);
+		const FVector PredictedLocation = Item.GetPredictedLocation(Now, GetBoidSettings(Boid).BaseMovementSpeed);
+		const float Displacement = static_cast<float>(FVector::Dist(Location, PredictedLocation));
+		const float HeadingCos = Item.GetHeading() | Boid->GetCurrentMoveVector().GetSafeNormal(UBoid::DefaultNormalizeVectorTolerance);
+		if (Displacement < ReplicationDistanceThreshold && HeadingCos >= CosHeadingThreshold)
+		{
+			continue;
+		}
+
+		double ViewDistanceSquared = ViewLocations.Num() > 0 ? TNumericLimits<double>::Max() : 1.0;
+		for (const FVector& ViewLocation : ViewLocations)
+		{
+			ViewDistanceSquared = FMath::Min(ViewDistanceSquared, FVector::DistSquared(ViewLocation, Location));
+		}
+
+		const float Error = Displacement / DistanceThreshold + (1.0f - HeadingCos) / (1.0f - CosHeadingThreshold);
+		const float Priority = Error / static_cast<float>(FMath::Max(FMath::Sqrt(ViewDistanceSquared), 100.0));
+		Candidates.Emplace(Priority, Slot);
+	}
+
+	if (Candidates.Num() > MaxReplicatedBoidsPerUpdate)
+	{
+		Candidates.Sort([](const TPair<float, int32>& A, const TPair<float, int32>& B) { return A.Key > B.Key; });
+		Candidates.SetNum(MaxReplicatedBoidsPerUpdate, false);
+	}
+
+	for (const TPair<float, int32>& Candidate : Candidates)
+	{
+		const UBoid* Boid = Boids[Candidate.Value];
+		FFlockReplicatedBoid& Item = ReplicatedFlock.Items[ReplicatedItemIndices.FindChecked(Boid->BoidId)];
+		Item.Pack(ToWorld(Boid->LocalLocation), Boid->GetCurrentMoveVector(), Now);
+		ReplicatedFlock.MarkItemDirty(Item);
+	}
+}
+
+void AAgent::OnReplicatedBoidAdded(const FFlockReplicatedBoid& Item)
+{
+	LLM_SCOPE_BYTAG(FlockAI_Replication);
+	const FVector3f Heading = Item.GetHeading();
+	UBoid* Boid = CreateBoid(Item.GetWorldLocation(), FVector(Heading).Rotation(), Item.ProfileIndex, static_cast<int32>(Item.BoidId));
+	Boid->ApplyReplicatedState(Boid->LocalLocation, Heading);
+}
+
+void AAgent::OnReplicatedBoidChanged(const FFlockReplicatedBoid& Item)
+{
+	if (UBoid** Boid = BoidsById.Find(static_cast<int32>(Item.BoidId)))
+	{
+		(*Boid)->ProfileIndex = Item.ProfileIndex;
+		(*Boid)->ApplyReplicatedState(ToLocal(Item.GetWorldLocation()), Item.GetHeading());
+	}
+}
+
+void AAgent::OnReplicatedBoidRemoved(const FFlockReplicatedBoid& Item)
+{
+	if (UBoid** Boid = BoidsById.Find(static_cast<int32>(Item.BoidId)))
+	{
+		RemoveBoid(*Boid);
+	}
+}
+
+int32 AAgent::GetNumHibernatedBoids() const
+{
+	int32 NumHibernatedBoids = 0;
+	for (const FFlockHibernationSummary& Summary : HibernatedFlocks)
+	{
+		NumHibernatedBoids += Summary.Count;
+	}
+	return NumHibernatedBoids;
+}
+
+bool AAgent::IsRegionActivated(const FBox& Bounds) const
+{
+	const UWorldPartitionSubsystem* WorldPartitionSubsystem = GetWorld()->GetSubsystem<UWorldPartitionSubsystem>();
+	if (WorldPartitionSubsystem == nullptr)
+	{
+		return true;
+	}
+
+	FWorldPartitionStreamingQuerySource QuerySource(Bounds.GetCenter());
+	QuerySource.Radius = FMath::Max(static_cast<float>(Bounds.GetExtent().Size()), 100.0f);
+	QuerySource.bUseGridLoadingRange = false;
+	return WorldPartitionSubsystem->IsStreamingCompleted(EWorldPartitionRuntimeCellState::Activated, {QuerySource}, false);
+}
+
+void AAgent::UpdateHibernation()
+{
+	// Clients follow the server, it hibernates and rehydrates the replicated boids
+	if (!bHibernateInUnloadedRegions || IsReplicatedProxy() || GetWorld()->GetWorldPartition() == nullptr)
+	{
+		return;
+	}
+
+	if (RehydratingFlock != INDEX_NONE)
+	{
+		RehydrateBoids();
+		return;
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (Now < NextHibernationCheckTime)
+	{
+		return;
+	}
+	NextHibernationCheckTime = Now + HibernationCheckInterval;
+
+	for (int32 Index = 0; Index < HibernatedFlocks.Num(); ++Index)
+	{
+		if (IsRegionActivated(HibernatedFlocks[Index].Bounds.ExpandBy(HibernationMargin)))
+		{
+			UE_LOG(LogFlockAI, Verbose, TEXT("Agent %s rehydrates %d boids"), *GetName(), HibernatedFlocks[Index].Count);
+			RehydratingFlock = Index;
+			RehydrateBoids();
+			return;
+		}
+	}
+
+	// Every cluster hibernates on its own, a boid straying into an unloaded cell does not take the others with it
+	TMap<FIntVector, TArray<UBoid*>> Clusters;
+	for (UBoid* Boid : Boids)
+	{
+		const FVector Location = ToWorld(Boid->LocalLocation) / HibernationCellSize;
+		Clusters.FindOrAdd(FIntVector(FMath::FloorToInt32(Location.X), FMath::FloorToInt32(Location.Y), 0)).Add(Boid);
+	}
+
+	for (const TPair<FIntVector, TArray<UBoid*>>& Cluster : Clusters)
+	{
+		FBox Bounds(ForceInit);
+		for (const UBoid* Boid : Cluster.Value)
+		{
+			Bounds += ToWorld(Boid->LocalLocation);
+		}
+
+		if (IsRegionActivated(Bounds))
+		{
+			UnloadedCellTimes.Remove(Cluster.Key);
+			continue;
+		}
+
+		if (Now - UnloadedCellTimes.FindOrAdd(Cluster.Key, Now) >= HibernationDelay)
+		{
+			HibernateBoids(Cluster.Value);
+			UnloadedCellTimes.Remove(Cluster.Key);
+		}
+	}
+
+	// The clusters that left a cell start their delay again
+	for (TMap<FIntVector, double>::TIterator It = UnloadedCellTimes.CreateIterator(); It; ++It)
+	{
+		if (!Clusters.Contains(It.Key()))
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void AAgent::HibernateBoids(TArrayView<UBoid* const> ClusterBoids)
+{
+	LLM_SCOPE_BYTAG(FlockAI_Boids);
+	TArray<FVector> Locations;
+	TArray<FVector3f> Headings;
+	TArray<uint8> ProfileIndices;
+	Locations.Reserve(ClusterBoids.Num());
+	Headings.Reserve(ClusterBoids.Num());
+	ProfileIndices.Reserve(ClusterBoids.Num());
+	for (const UBoid* Boid : ClusterBoids)
+	{
+		Locations.Add(ToWorld(Boid->LocalLocation));
+		Headings.Add(Boid->GetCurrentMoveVector());
+		ProfileIndices.Add(Boid->ProfileIndex);
+	}
+
+	FFlockHibernationSummary& Summary = HibernatedFlocks.AddDefaulted_GetRef();
+	Summary.Build(Locations, Headings, ProfileIndices);
+	UE_LOG(LogFlockAI, Verbose, TEXT("Agent %s hibernates %d boids around %s"), *GetName(), Summary.Count, *Summary.Centroid.ToString());
+
+	PendingBoidRemovals.Append(ClusterBoids.GetData(), ClusterBoids.Num());
+	ApplyPendingBoidRemovals();
+}
+
+void AAgent::RehydrateBoids()
+{
+	LLM_SCOPE_BYTAG(FlockAI_Boids);
+	check(HibernatedFlocks.IsValidIndex(RehydratingFlock));
+	FFlockHibernationSummary& Summary = HibernatedFlocks[RehydratingFlock];
+
+	// Spread over several frames, every boid costs an object and a render instance
+	FVector Location;
+	FRotator Rotation;
+	uint8 ProfileIndex;
+	for (int32 Spawned = 0; Spawned < RehydratedBoidsPerFrame && Summary.PopBoid(Location, Rotation, ProfileIndex); ++Spawned)
+	{
+		SpawnBoid(Location, Rotation, ProfileIndex);
+	}
+
+	if (Summary.IsEmpty())
+	{
+		HibernatedFlocks.RemoveAt(RehydratingFlock);
+		RehydratingFlock = INDEX_NONE;
+	}
+}
+
+void AAgent::Tick(float DeltaSeconds)
+{
+	LLM_SCOPE_BYTAG(FlockAI);
+	Super::Tick(DeltaSeconds);
+	UpdateHibernation();
+
+	const uint64 TickStart = FPlatformTime::Cycles64();
+	ApplyCommands();
+	const uint64 CommandsEnd = FPlatformTime::Cycles64();
+	if (Boids.Num() == 0)
+	{
+		StageTimings = FFlockStageTimings();
+		Statistics.Reset();
+		return;
+	}
+
+	if (IsReplicatedProxy())
+	{
+		UpdateProxyBoids(DeltaSeconds);
+	}
+	else
+	{
+		if (FlowField != nullptr && FlowField->IsBaked())
+		{
+			LLM_SCOPE_BYTAG(FlockAI_Navigation);
+			FlowField->UpdateGoals(FlowFieldCellsPerTick);
+		}
+		UpdateBoids(DeltaSeconds);
+	}
+
+	const uint64 TickEnd = FPlatformTime::Cycles64();
+
+	if (ShouldReplicateFlock())
+	{
+		UpdateReplicatedFlock();
+	}
+
+	StageTimings.CommandsMs = FPlatformTime::ToMilliseconds64(CommandsEnd - TickStart);
+	StageTimings.TotalMs = FPlatformTime::ToMilliseconds64(TickEnd - TickStart);
 }
@@ -4,112 +4,195 @@
 
 #include "Agent.h"
 #include "Stimulus.h"
+#include "FlockDistanceField.h"
+#include "FlockFlowField.h"
 #include "Engine/EngineTypes.h"
-#include "Kismet/KismetMathLibrary.h"
 #include "Kismet/KismetSystemLibrary.h"
 #include "GameFramework/Actor.h"
-#include "DrawDebugHelpers.h"
+
+namespace FlockBoid
+{
+	constexpr bool HasFeature(EFlockFeatures Features, EFlockFeatures Feature)
+	{
+		return (static_cast<uint8>(Features) & static_cast<uint8>(Feature)) != 0;
+	}
+}
 
 UBoid::UBoid()
-	: AlignmentWeight(1.0f)
-	, CohesionWeight(1.0f)
-	, CohesionLerp(100.0f)
-	, CollisionWeight(1.0f)
-	, SeparationLerp(5.0f)
-	, SeparationForce(100.0f)
-	, StimuliLerp(100.0f)
-	, SeparationWeight(0.8f)
-	, BaseMovementSpeed(150.0f)
-	, MaxMovementSpeed(250.0f)
-	, VisionRadius(400.0f)
-	, CollisionDistanceLook(400.0f)
-	, MaxRotationSpeed(6.0f)
-	, MeshIndex(0)
-	, Transform(FTransform::Identity)
-	, AlignmentComponent(0.0)
-	, CohesionComponent(0.0)
-	, SeparationComponent(0.0)
-	, NegativeStimuliComponent(0.0)
-	, PositiveStimuliComponent(0.0)
-	, CollisionComponent(0.0)
+	: MeshIndex(0)
+	, BoidId(0)
+	, ProfileIndex(0)
+	, SettingsOverrideIndex(INDEX_NONE)
+	, LocalLocation(FVector3f::ZeroVector)
+	, LocalRotation(FQuat4f::Identity)
+	, AlignmentComponent(0.0f)
+	, CohesionComponent(0.0f)
+	, SeparationComponent(0.0f)
+	, NegativeStimuliComponent(0.0f)
+	, PositiveStimuliComponent(0.0f)
+	, CollisionComponent(0.0f)
+	, BehaviourComponent(0.0f)
 	, NegativeStimuliMaxFactor(0.0f)
 	, PositiveStimuliMaxFactor(0.0f)
-	, InertiaWeigh(0.0f)
-	, BoidPhysicalRadius(45.0f)
-	, bEnableDebugDraw(false)
-	, DebugRayDuration(0.12f)
+	, FlockSlot(INDEX_NONE)
+	, bOffscreen(false)
+	, bImpostor(false)
+	, AnimationPhase(0.0f)
+	, AnimationSpeed(0.0f)
+	, AnimationTurnRate(0.0f)
+	, RenderedLocation(FVector3f::ZeroVector)
+	, NetLocation(FVector3f::ZeroVector)
+	, NeighbourListLocation(FVector3f::ZeroVector)
+	, NewMoveVector(FVector3f::ForwardVector)
+	, CurrentMoveVector(FVector3f::ForwardVector)
+	, Settings(nullptr)
 {
-	Boid2PhysicalRadius = 2 * BoidPhysicalRadius;
 }
 
 void UBoid::ResetComponents()
 {
-	AlignmentComponent = FVector::ZeroVector;
-	CohesionComponent = FVector::ZeroVector;
-	SeparationComponent = FVector::ZeroVector;
-	NegativeStimuliComponent = FVector::ZeroVector;
-	PositiveStimuliComponent = FVector::ZeroVector;
-	CollisionComponent = FVector::ZeroVector;
+	AlignmentComponent = FVector3f::ZeroVector;
+	CohesionComponent = FVector3f::ZeroVector;
+	SeparationComponent = FVector3f::ZeroVector;
+	NegativeStimuliComponent = FVector3f::ZeroVector;
+	PositiveStimuliComponent = FVector3f::ZeroVector;
+	CollisionComponent = FVector3f::ZeroVector;
 	NegativeStimuliMaxFactor = 0.0f;
 	PositiveStimuliMaxFactor = 0.0f;
 	ComputedStimulus.Empty(ComputedStimulus.Num());
+	FarField = FFlockFarFieldSample();
 }
 
-void UBoid::Init(const FVector& Location, const FRotator& Rotation, int32 MeshInstanceIndex)
+void UBoid::Init(const FVector3f& Location, const FRotator& Rotation, int32 MeshInstanceIndex)
 {
-	Transform.SetRotation(Rotation.Quaternion());
-	Transform.SetLocation(Location);
+	LocalRotation = FQuat4f(Rotation.Quaternion());
+	LocalLocation = Location;
+	NeighbourListLocation = Location;
+	RenderedLocation = Location;
+	NetLocation = Location;
 	MeshIndex = MeshInstanceIndex;
-	NewMoveVector = Rotation.Vector().GetSafeNormal();
+	NewMoveVector = FVector3f(Rotation.Vector()).GetSafeNormal();
+	// Out of step with the rest of the flock
+	AnimationPhase = FMath::FRand();
+}
+
+SIZE_T UBoid::GetAllocatedSize() const
+{
+	return GetClass()->GetStructureSize() + Neighbourhood.GetAllocatedSize() + StimulusInVision.GetAllocatedSize()
+		+ NeighbourCandidates.GetAllocatedSize() + PrivateGlobalStimulus.GetAllocatedSize() + ComputedStimulus.GetAllocatedSize();
 }
 
+const FFlockBoidSettings& UBoid::GetSettings() const
+{
+	return CastChecked<AAgent>(GetOuter())->GetBoidSettings(this);
+}
 
-void UBoid::Update(float DeltaSeconds, AAgent* Agent)
+FVector UBoid::GetWorldLocation() const
+{
+	const AAgent* Agent = GetTypedOuter<AAgent>();
+	return Agent != nullptr ? Agent->ToWorld(LocalLocation) : FVector(LocalLocation);
+}
+
+FTransform UBoid::GetWorldTransform() const
+{
+	return FTransform(FQuat(LocalRotation), GetWorldLocation());
+}
+
+FORCEINLINE void UBoid::UpdateStages(float DeltaSeconds, AAgent* Agent, EFlockFeatures Features)
 {
 	CurrentMoveVector = NewMoveVector;
-	CalculateNewMoveVector(Agent);
-	
-	const FVector NewDirection = (NewMoveVector * BaseMovementSpeed * DeltaSeconds).GetClampedToMaxSize(MaxMovementSpeed * DeltaSeconds);
-	Transform.SetLocation(Transform.GetLocation() + NewDirection);
-	Transform.SetRotation(
-		UKismetMathLibrary::RLerp(
-			Transform.Rotator(),
-			UKismetMathLibrary::MakeRotFromXZ(NewDirection, FVector::UpVector),
-			DeltaSeconds * MaxRotationSpeed, false).Quaternion());
-	if (bFollowFloorZ)
+	CalculateNewMoveVector(Agent, Features);
+	IntegrateMovement(DeltaSeconds);
+
+	// Off screen boids keep their height until they are visible again
+	if (FlockBoid::HasFeature(Features, EFlockFeatures::FollowFloor) && !bOffscreen)
+	{
+		FindGroundLocation(Agent, Settings->MaxFloorDistance, ECC_WorldStatic, Settings->FloorHeightOffset);
+	}
+}
+
+void UBoid::Update(float DeltaSeconds, AAgent* Agent)
+{
+	Settings = &Agent->GetBoidSettings(this);
+	UpdateStages(DeltaSeconds, Agent, Settings->GetFeatures());
+}
+
+template <EFlockFeatures Features>
+void UBoid::UpdatePipeline(float DeltaSeconds, AAgent* Agent)
+{
+	// The stages are inlined with a constant mask, the ones this flock does not use are compiled out
+	Settings = &Agent->GetBoidSettings(this);
+	UpdateStages(DeltaSeconds, Agent, Features);
+}
+
+template <uint8... FeatureMasks>
+const UBoid::FUpdatePipeline* UBoid::MakeUpdatePipelines(TIntegerSequence<uint8, FeatureMasks...>)
+{
+	static const FUpdatePipeline Pipelines[] = {&UBoid::UpdatePipeline<static_cast<EFlockFeatures>(FeatureMasks)>...};
+	return Pipelines;
+}
+
+UBoid::FUpdatePipeline UBoid::GetUpdatePipeline(EFlockFeatures Features)
+{
+	// One instance of the update for every combination of stages
+	static const FUpdatePipeline* Pipelines = MakeUpdatePipelines(TMakeIntegerSequence<uint8, static_cast<uint8>(EFlockFeatures::All) + 1>());
+	return Pipelines[static_cast<uint8>(Features & EFlockFeatures::All)];
+}
+
+void UBoid::IntegrateMovement(float DeltaSeconds)
+{
+	const FVector3f NewDirection = (NewMoveVector * Settings->BaseMovementSpeed * DeltaSeconds).GetClampedToMaxSize(Settings->MaxMovementSpeed * DeltaSeconds);
+	const FQuat4f PreviousRotation = LocalRotation;
+	LocalLocation += NewDirection;
+	if (!NewDirection.IsNearlyZero())
 	{
-		FindGroundLocation(Agent, MaxFloorDistance, ECC_WorldStatic, FloorHeightOffset);
+		const FQuat4f TargetRotation = FRotationMatrix44f::MakeFromXZ(NewDirection, FVector3f::UpVector).ToQuat();
+		LocalRotation = FQuat4f::Slerp(LocalRotation, TargetRotation, FMath::Min(DeltaSeconds * Settings->MaxRotationSpeed, 1.0f));
 	}
+	UpdateAnimationState(DeltaSeconds, NewDirection, PreviousRotation);
 }
 
-#if UE_ENABLE_DEBUG_DRAWING
-void UBoid::DebugDraw() const
+void UBoid::UpdateAnimationState(float DeltaSeconds, const FVector3f& Displacement, const FQuat4f& PreviousRotation)
 {
-	const UWorld* World = GetWorld();
-	const FVector& Location = Transform.GetLocation();
-	DrawDebugLine(World, Location,
-				  Location + CurrentMoveVector * 300.0f,
-				  FColor::Green, false, DebugRayDuration, 0, 1.0f);
+	if (DeltaSeconds <= 0.0f)
+	{
+		return;
+	}
 
-	DrawDebugLine(World, Location,
-				  Location + CohesionComponent * CohesionWeight * 100.0f,
-				  FColor::Orange, false, DebugRayDuration, 0, 1.0f);
+	const float InverseDeltaSeconds = 1.0f / DeltaSeconds;
+	AnimationSpeed = Displacement.Size() * InverseDeltaSeconds;
+	// Signed angle between the headings on the floor plane
+	const FVector3f PreviousForward = PreviousRotation.GetForwardVector();
+	const FVector3f Forward = LocalRotation.GetForwardVector();
+	AnimationTurnRate = FMath::Atan2(PreviousForward.X * Forward.Y - PreviousForward.Y * Forward.X,
+									 PreviousForward.X * Forward.X + PreviousForward.Y * Forward.Y) * InverseDeltaSeconds;
+
+	const float CyclesPerSecond = Settings->AnimationIdleRate
+		+ (Settings->AnimationStrideLength > 0.0f ? AnimationSpeed / Settings->AnimationStrideLength : 0.0f);
+	AnimationPhase = FMath::Frac(AnimationPhase + CyclesPerSecond * DeltaSeconds);
+}
 
-	DrawDebugLine(World, Location,
-				  Location + AlignmentComponent * AlignmentWeight * 100.0f,
-				  FColor::Purple, false, DebugRayDuration, 0, 1.0f);
+void UBoid::ApplyReplicatedState(const FVector3f& Location, const FVector3f& Heading)
+{
+	NetLocation = Location;
+	NewMoveVector = Heading;
+	CurrentMoveVector = Heading;
+}
 
-	DrawDebugLine(World, Location,
-				  Location + (SeparationComponent * SeparationWeight * 100.0f),
-				  FColor::Blue, false, DebugRayDuration, 0, 1.0f);
-	if (CollisionWeight > 0.0f)
+void UBoid::UpdateProxy(float DeltaSeconds, float SmoothingSpeed, AAgent* Agent)
+{
+	Settings = &Agent->GetBoidSettings(this);
+	NetLocation += CurrentMoveVector * Settings->BaseMovementSpeed * DeltaSeconds;
+	const FVector3f PreviousLocation = LocalLocation;
+	const FQuat4f PreviousRotation = LocalRotation;
+	LocalLocation = FMath::Lerp(LocalLocation, NetLocation, FMath::Min(DeltaSeconds * SmoothingSpeed, 1.0f));
+	if (!CurrentMoveVector.IsNearlyZero())
 	{
-		DrawDebugLine(World, Location, 
-				  Location + CollisionComponent * CollisionWeight  * 100.0f,
-				  FColor::Red, false, DebugRayDuration, 0, 1.0f);
+		const FQuat4f TargetRotation = FRotationMatrix44f::MakeFromXZ(CurrentMoveVector, FVector3f::UpVector).ToQuat();
+		LocalRotation = FQuat4f::Slerp(LocalRotation, TargetRotation, FMath::Min(DeltaSeconds * Settings->MaxRotationSpeed, 1.0f));
 	}
+	UpdateAnimationState(DeltaSeconds, LocalLocation - PreviousLocation, PreviousRotation);
 }
-#endif
 
 void UBoid::AddPrivateGlobalStimulus(AStimulus* Stimulus)
 {
@@ -126,60 +209,77 @@ void UBoid::RemovePrivateGlobalStimulus(AStimulus* Stimulus)
 	PrivateGlobalStimulus.Remove(Stimulus);
 }
 
-void UBoid::CalculateNewMoveVector(AAgent* Agent)
+FORCEINLINE void UBoid::CalculateNewMoveVector(AAgent* Agent, EFlockFeatures Features)
 {
+	using namespace FlockBoid;
 	ResetComponents();
-	CalculateAlignmentComponentVector();
+	if (HasFeature(Features, EFlockFeatures::Alignment | EFlockFeatures::Cohesion) && Settings->bUseFarField && !bOffscreen)
+	{
+		CalculateFarFieldSample(Agent);
+	}
 
-	if (Neighbourhood.Num() > 0)
+	if (HasFeature(Features, EFlockFeatures::Alignment))
+	{
+		CalculateAlignmentComponentVector();
+	}
+
+	if (HasFeature(Features, EFlockFeatures::Cohesion) && (NeighbourSums.Count > 0 || FarField.Count > 0))
 	{
 		CalculateCohesionComponentVector();
-		CalculateSeparationComponentVector();
 	}
 
-	ComputeAllStimuliComponentVector(Agent);
+	if (HasFeature(Features, EFlockFeatures::Separation) && NeighbourSums.Count > 0)
+	{
+		CalculateSeparationComponentVector();
+	}
 
-	if (CollisionWeight != 0.0f)
+	if (HasFeature(Features, EFlockFeatures::Stimuli))
 	{
-		CalculateCollisionComponentVector(Agent);
+		ComputeAllStimuliComponentVector(Agent);
 	}
 
-	ComputeAggregationOfComponents();
-#if UE_ENABLE_DEBUG_DRAWING
-	if (bEnableDebugDraw)
+	if (HasFeature(Features, EFlockFeatures::Collision))
 	{
-		DebugDraw();
+		CalculateCollisionComponentVector(Agent);
 	}
-#endif
+
+	ComputeAggregationOfComponents(Features);
+}
+
+void UBoid::CalculateFarFieldSample(AAgent* Agent)
+{
+	check(Agent);
+	Agent->GetFlockOctree().AccumulateFarField(
+		LocalLocation, Settings->VisionRadius, Settings->FarFieldRadius, Settings->FarFieldOpeningAngle, FarField);
 }
 
 void UBoid::CalculateAlignmentComponentVector()
 {
-	for (const UBoid* Boid : Neighbourhood)
-	{
-		AlignmentComponent += Boid->CurrentMoveVector.GetSafeNormal(DefaultNormalizeVectorTolerance);
-	}
+	// Both store the sum of the unit headings
+	AlignmentComponent = NeighbourSums.HeadingSum + FarField.HeadingSum * Settings->FarFieldWeight;
 
-	AlignmentComponent = (CurrentMoveVector + AlignmentComponent).GetSafeNormal(DefaultNormalizeVectorTolerance) * AlignmentWeight;
+	AlignmentComponent = (CurrentMoveVector + AlignmentComponent).GetSafeNormal(DefaultNormalizeVectorTolerance) * Settings->AlignmentWeight;
 }
 
 void UBoid::CalculateCohesionComponentVector()
 {
-	const FVector& Location = Transform.GetLocation();
-	for (const UBoid* Boid : Neighbourhood)
+	CohesionComponent = NeighbourSums.CohesionSum + (FarField.LocationSum - LocalLocation * FarField.Count) * Settings->FarFieldWeight;
+	const float CohesionCount = NeighbourSums.Count + FarField.Count * Settings->FarFieldWeight;
+	if (CohesionCount <= 0.0f)
 	{
-		CohesionComponent += Boid->Transform.GetLocation() - Location;
+		CohesionComponent = FVector3f::ZeroVector;
+		return;
 	}
 
-	CohesionComponent = (CohesionComponent / Neighbourhood.Num() / CohesionLerp) * CohesionWeight;
+	CohesionComponent = (CohesionComponent / CohesionCount / Settings->CohesionLerp) * Settings->CohesionWeight;
 }
 
-bool UBoid::CheckStimulusVision()
+bool UBoid::CheckStimulusVision(const FVector& WorldLocation)
 {
 	static TArray<TEnumAsByte<EObjectTypeQuery>> ObjectTypes{{UEngineTypes::ConvertToObjectType(ECC_Destructible)}};
 	return UKismetSystemLibrary::SphereOverlapActors(
-		this, Transform.GetLocation(),
-		VisionRadius,
+		this, WorldLocation,
+		Settings->VisionRadius,
 		ObjectTypes,
 		AStimulus::StaticClass(),
 		TArray<AActor*>(),
@@ -188,44 +288,95 @@ bool UBoid::CheckStimulusVision()
 
 void UBoid::CalculateSeparationComponentVector()
 {
-	const FVector& Location = Transform.GetLocation();
-
-	for (const UBoid* Boid : Neighbourhood)
-	{
-		FVector Separation = Location - Boid->Transform.GetLocation();
-		SeparationComponent += Separation.GetSafeNormal(DefaultNormalizeVectorTolerance)
-			/ FMath::Abs(Separation.Size() - BoidPhysicalRadius);
-	}
-
-	const FVector SeparationForceComponent = SeparationComponent * SeparationForce;
-	SeparationComponent += (SeparationForceComponent + SeparationForceComponent * (SeparationLerp / Neighbourhood.Num())) * SeparationWeight;
+	SeparationComponent = NeighbourSums.SeparationSum;
+	const FVector3f SeparationForceComponent = SeparationComponent * Settings->SeparationForce;
+	SeparationComponent += (SeparationForceComponent + SeparationForceComponent * (Settings->SeparationLerp / NeighbourSums.Count)) * Settings->SeparationWeight;
 }
 
 void UBoid::ComputeAllStimuliComponentVector(AAgent* Agent)
 {
-	CheckStimulusVision();
+	const FFlockStimulusField& StimulusField = Agent->GetStimulusField();
+	const FVector WorldLocation = Agent->ToWorld(LocalLocation);
+	if (bOffscreen)
+	{
+		StimulusInVision.Reset();
+	}
+	else
+	{
+		CheckStimulusVision(WorldLocation);
+	}
 
-	const FVector& Location = Transform.GetLocation();
 	for (AActor* Stimulus : StimulusInVision)
 	{
-		ComputeStimuliComponentVector(Agent, Cast<AStimulus>(Stimulus), Location);
+		// The far global stimuli are counted by the sample of the grid, the ones next to the boid are seen as usual
+		AStimulus* VisibleStimulus = Cast<AStimulus>(Stimulus);
+		if (!StimulusField.IsBuilt() || !StimulusField.Contains(VisibleStimulus) || StimulusField.IsAdjacent(VisibleStimulus, WorldLocation))
+		{
+			ComputeStimuliComponentVector(Agent, VisibleStimulus);
+		}
 	}
-	
-	for (AStimulus* Stimulus : Agent->GetGlobalStimulus())
+
+	if (!StimulusField.IsBuilt() || !ApplyStimulusField(Agent, StimulusField, WorldLocation))
 	{
-		ComputeStimuliComponentVector(Agent, Stimulus, Location, true);
+		for (AStimulus* Stimulus : Agent->GetGlobalStimulus())
+		{
+			ComputeStimuliComponentVector(Agent, Stimulus, true);
+		}
 	}
-	
 
 	for (AStimulus* Stimulus : PrivateGlobalStimulus)
 	{
-		ComputeStimuliComponentVector(Agent, Stimulus, Location, true);
+		ComputeStimuliComponentVector(Agent, Stimulus, true);
 	}
-	
+
 	NegativeStimuliComponent = NegativeStimuliMaxFactor * NegativeStimuliComponent.GetSafeNormal(DefaultNormalizeVectorTolerance);
 }
 
-void UBoid::ComputeStimuliComponentVector(AAgent* Agent, AStimulus* Stimulus, const FVector& Location, bool bIsGlobal)
+bool UBoid::ApplyStimulusField(AAgent* Agent, const FFlockStimulusField& StimulusField, const FVector& WorldLocation)
+{
+	FFlockStimulusSample Sample;
+	if (!StimulusField.Sample(WorldLocation, Settings->BoidPhysicalRadius, ComputedStimulus, Sample))
+	{
+		return false;
+	}
+
+	NegativeStimuliComponent += Sample.NegativeSum * Settings->StimuliLerp;
+	NegativeStimuliMaxFactor = FMath::Max(NegativeStimuliMaxFactor, Sample.NegativeMaxFactor * Settings->StimuliLerp);
+
+	if (Sample.PositiveMaxFactor > PositiveStimuliMaxFactor)
+	{
+		PositiveStimuliMaxFactor = Sample.PositiveMaxFactor;
+
+		// With a flow field the pull goes around the terrain toward the strongest stimulus
+		FVector3f PositivePull = Sample.PositiveSum;
+		UFlockFlowField* FlowField = Agent->GetFlowField();
+		FVector Goal;
+		FVector3f FlowDirection;
+		if (FlowField != nullptr && FlowField->IsBaked() && StimulusField.GetStrongestPositive(Goal)
+			&& FlowField->SampleDirection(Goal, WorldLocation, FlowDirection))
+		{
+			PositivePull = FlowDirection * PositivePull.Size();
+		}
+		PositiveStimuliComponent += PositivePull;
+	}
+
+	// Only the stimuli listed in the cell of the boid can be close enough to be consumed
+	TArray<AStimulus*, TInlineAllocator<4>> Consumable;
+	StimulusField.GetConsumableStimuli(WorldLocation, Consumable);
+	for (AStimulus* Stimulus : Consumable)
+	{
+		if (IsValid(Stimulus) && !ComputedStimulus.Contains(Stimulus)
+			&& FVector::Dist(Stimulus->GetActorLocation(), WorldLocation) <= Settings->GetBoid2PhysicalRadius() + Stimulus->Radius)
+		{
+			ComputedStimulus.Add(Stimulus);
+			Stimulus->Consume(this, Agent);
+		}
+	}
+
+	return true;
+}
+
+void UBoid::ComputeStimuliComponentVector(AAgent* Agent, AStimulus* Stimulus, bool bIsGlobal)
 {
 	if (!IsValid(Stimulus) || ComputedStimulus.Contains(Stimulus))
 	{
@@ -234,39 +385,49 @@ void UBoid::ComputeStimuliComponentVector(AAgent* Agent, AStimulus* Stimulus, co
 
 	ComputedStimulus.Add(Stimulus);
 
+	const FVector3f Direction = Agent->ToLocal(Stimulus->GetActorLocation()) - LocalLocation;
 	if (Stimulus->Value < 0.0f)
 	{
-		CalculateNegativeStimuliComponentVector(Stimulus, bIsGlobal);
+		CalculateNegativeStimuliComponentVector(Stimulus, Direction, bIsGlobal);
 	}
 	else
 	{
-		if (FVector::Dist(Stimulus->GetActorLocation(), Location) <= (Boid2PhysicalRadius + Stimulus->Radius))
+		if (Direction.Size() <= (Settings->GetBoid2PhysicalRadius() + Stimulus->Radius))
 		{
 			Stimulus->Consume(this, Agent);
 		}
 		else
 		{
-			CalculatePositiveStimuliComponentVector(Stimulus, bIsGlobal);
+			// Around the terrain when the Agent has a flow field, the distance still weighs the stimulus
+			UFlockFlowField* FlowField = Agent->GetFlowField();
+			FVector3f FlowDirection;
+			if (FlowField != nullptr && FlowField->IsBaked()
+				&& FlowField->SampleDirection(Stimulus->GetActorLocation(), Agent->ToWorld(LocalLocation), FlowDirection))
+			{
+				CalculatePositiveStimuliComponentVector(Stimulus, FlowDirection * Direction.Size(), bIsGlobal);
+			}
+			else
+			{
+				CalculatePositiveStimuliComponentVector(Stimulus, Direction, bIsGlobal);
+			}
 		}
 	}
 }
 
-void UBoid::CalculateNegativeStimuliComponentVector(const AStimulus* Stimulus, bool bIsGlobal)
+void UBoid::CalculateNegativeStimuliComponentVector(const AStimulus* Stimulus, const FVector3f& Direction, bool bIsGlobal)
 {
 	check(Stimulus);
-	const FVector Direction = Stimulus->GetActorLocation() - Transform.GetLocation();
-	const FVector NegativeStimuliComponentForce =
+	const FVector3f NegativeStimuliComponentForce =
 		(Direction.GetSafeNormal(DefaultNormalizeVectorTolerance)
-			/ FMath::Abs(Direction.Size() - BoidPhysicalRadius))
-		* StimuliLerp * Stimulus->Value;
+			/ FMath::Abs(Direction.Size() - Settings->BoidPhysicalRadius))
+		* Settings->StimuliLerp * Stimulus->Value;
 	NegativeStimuliComponent += NegativeStimuliComponentForce;
 	NegativeStimuliMaxFactor = FMath::Max(NegativeStimuliComponentForce.Size(), NegativeStimuliMaxFactor);
 }
 
-void UBoid::CalculatePositiveStimuliComponentVector(const AStimulus* Stimulus, bool bIsGlobal)
+void UBoid::CalculatePositiveStimuliComponentVector(const AStimulus* Stimulus, const FVector3f& Direction, bool bIsGlobal)
 {
 	check(Stimulus);
-	const FVector Direction = Stimulus->GetActorLocation() - Transform.GetLocation();
 	const float Svalue = bIsGlobal ? Stimulus->Value : Stimulus->Value / Direction.Size();
 	if (Svalue > PositiveStimuliMaxFactor)
 	{
@@ -277,47 +438,61 @@ void UBoid::CalculatePositiveStimuliComponentVector(const AStimulus* Stimulus, b
 
 void UBoid::CalculateCollisionComponentVector(AAgent* Agent)
 {
+	const FVector Location = Agent->ToWorld(LocalLocation);
+
+	// The baked field sees the obstacles all around the boid for a few memory reads
+	float Distance;
+	FVector Gradient;
+	const UFlockDistanceField* DistanceField = Agent->GetDistanceField();
+	if (DistanceField != nullptr && DistanceField->Sample(Location, Distance, Gradient))
+	{
+		if (Distance < Settings->CollisionDistanceLook && !Gradient.IsNearlyZero())
+		{
+			CollisionComponent += (FVector3f(Gradient).GetSafeNormal(DefaultNormalizeVectorTolerance) / FMath::Max(FMath::Abs(Distance - Settings->BoidPhysicalRadius), 1.0f))
+								  .RotateAngleAxis(static_cast<float>(Settings->CollisionDeviationHitAngle), FVector3f::UpVector) * Settings->CollisionWeight;
+		}
+		return;
+	}
+
+	if (bOffscreen)
+	{
+		return;
+	}
+
 	FHitResult OutHit;
-	const FVector& Location = Transform.GetLocation();
 	static const FName LineTraceSingleName(TEXT("LineTraceSingle"));
-	const FVector End = Location + Transform.GetRotation().GetForwardVector() * CollisionDistanceLook;
+	const FVector End = Location + FVector(LocalRotation.GetForwardVector() * Settings->CollisionDistanceLook);
 	FCollisionQueryParams Params(LineTraceSingleName, false);
 	Params.AddIgnoredActor(Agent);
-	const static FCollisionShape SphereShape = FCollisionShape::MakeSphere(BoidPhysicalRadius);
-	
-	if (GetWorld()->SweepSingleByChannel(OutHit, Location, End, FQuat::Identity, ECC_WorldStatic, SphereShape, Params))
-	{
-		const FVector Direction = OutHit.ImpactPoint - Transform.GetLocation();
-		CollisionComponent -= (Direction.GetSafeNormal(DefaultNormalizeVectorTolerance) / FMath::Abs(Direction.Size() - BoidPhysicalRadius))
-							  .RotateAngleAxis(CollisionDeviationHitAngle, FVector::UpVector) * CollisionWeight;
+	const FCollisionShape SphereShape = FCollisionShape::MakeSphere(Settings->BoidPhysicalRadius);
 
-#if ENABLE_DRAW_DEBUG
-	if (bEnableDebugDraw)
+	if (GetWorld()->SweepSingleByChannel(OutHit, Location, End, FQuat::Identity, ECC_WorldStatic, SphereShape, Params))
 	{
-		UKismetSystemLibrary::DrawDebugArrow(GetWorld(), Location, OutHit.ImpactPoint,  Boid2PhysicalRadius, FColor::Red, 4.0f);
-	}
-#endif
+		const FVector3f Direction(OutHit.ImpactPoint - Location);
+		CollisionComponent -= (Direction.GetSafeNormal(DefaultNormalizeVectorTolerance) / FMath::Abs(Direction.Size() - Settings->BoidPhysicalRadius))
+							  .RotateAngleAxis(static_cast<float>(Settings->CollisionDeviationHitAngle), FVector3f::UpVector) * Settings->CollisionWeight;
 	}
 }
 
-void UBoid::ComputeAggregationOfComponents()
+FORCEINLINE void UBoid::ComputeAggregationOfComponents(EFlockFeatures Features)
 {
 	NewMoveVector = AlignmentComponent
 		+ CohesionComponent
 		+ SeparationComponent
 		+ NegativeStimuliComponent
 		+ PositiveStimuliComponent
-		+ CollisionComponent;
+		+ CollisionComponent
+		+ BehaviourComponent;
 
-	if (bFollowFloorZ)
+	if (FlockBoid::HasFeature(Features, EFlockFeatures::FollowFloor))
 	{
-		NewMoveVector.Z = 0.0;
+		NewMoveVector.Z = 0.0f;
 	}
 }
 
 void UBoid::FindGroundLocation(AAgent* Agent, float TraceDistance, ECollisionChannel CollisionChannel, float HeightOffSet)
 {
-	FVector Location = Transform.GetLocation();
+	FVector Location = Agent->ToWorld(LocalLocation);
 	FVector TraceEnd = Location;
 	FVector TraceStart = Location;
 	TraceStart.Z += TraceDistance;
@@ -331,13 +506,7 @@ void UBoid::FindGroundLocation(AAgent* Agent, float TraceDistance, ECollisionCha
 	{
 		Location = HitResult.ImpactPoint;
 		Location.Z += HeightOffSet;
-		
-		Transform.SetLocation(Location);
-#if UE_ENABLE_DEBUG_DRAWING
-		if (bEnableDebugDraw && FloorRayDuration > 0.0f)
-		{
-			UKismetSystemLibrary::DrawDebugArrow(GetWorld(), TraceStart, bHit ? Location : TraceEnd, 25.0f, FColor::Red, FloorRayDuration);
-		}
-#endif
+
+		LocalLocation = Agent->ToLocal(Location);
 	}
 }
@@ -6,4 +6,11 @@
 IMPLEMENT_MODULE(FFlockAIAPIModule, FlockAI);
 
 DEFINE_LOG_CATEGORY(LogFlockAI)
+
+LLM_DEFINE_TAG(FlockAI);
+LLM_DEFINE_TAG(FlockAI_Boids);
+LLM_DEFINE_TAG(FlockAI_Spatial);
+LLM_DEFINE_TAG(FlockAI_Rendering);
+LLM_DEFINE_TAG(FlockAI_Navigation);
+LLM_DEFINE_TAG(FlockAI_Replication);
 #undef LOCTEXT_NAMESPACE
\ No newline at end of file
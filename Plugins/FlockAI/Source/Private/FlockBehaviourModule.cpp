@@ -0,0 +1,27 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockBehaviourModule.h"
+
+#include "Agent.h"
+
+void UFlockBoundsModule::PrepareEvaluation(const FFlockBehaviourContext& Context)
+{
+	check(Context.Agent);
+	const FBox Inner = Bounds.ExpandBy(-static_cast<double>(Margin));
+	InnerMin = Context.Agent->ToLocal(FVector::Min(Inner.Min, Inner.GetCenter()));
+	InnerMax = Context.Agent->ToLocal(FVector::Max(Inner.Max, Inner.GetCenter()));
+}
+
+void UFlockBoundsModule::Evaluate(const FFlockBehaviourContext& Context, int32 Begin, int32 End, TArrayView<FVector3f> OutForces) const
+{
+	// Penetration in the margin on every axis, in margins
+	const float InverseMargin = 1.0f / Margin;
+	for (int32 Slot = Begin; Slot < End; ++Slot)
+	{
+		const FVector3f& Location = Context.Locations[Slot];
+		OutForces[Slot] = FVector3f(
+			FMath::Max(InnerMin.X - Location.X, 0.0f) - FMath::Max(Location.X - InnerMax.X, 0.0f),
+			FMath::Max(InnerMin.Y - Location.Y, 0.0f) - FMath::Max(Location.Y - InnerMax.Y, 0.0f),
+			FMath::Max(InnerMin.Z - Location.Z, 0.0f) - FMath::Max(Location.Z - InnerMax.Z, 0.0f)) * InverseMargin;
+	}
+}
@@ -0,0 +1,385 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockBenchmarkCommandlet.h"
+
+#include "Agent.h"
+#include "FlockAI.h"
+#include "Algo/Find.h"
+#include "Stimulus.h"
+#include "Dom/JsonObject.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonSerializer.h"
+#include "UObject/Package.h"
+
+namespace FlockBenchmark
+{
+	struct FScenario
+	{
+		int32 NumBoids = 0;
+		// Distance between neighbour boids of the starting grid, it sets the density of the flock
+		float Spacing = 0.0f;
+		int32 NumStimuli = 0;
+		bool bCollision = false;
+		bool bFollowFloor = false;
+		bool bSpecialisedPipelines = true;
+		EFlockRenderBackend RenderBackend = EFlockRenderBackend::HierarchicalInstancedStaticMesh;
+
+		FString GetName() const
+		{
+			return FString::Printf(TEXT("N%d_S%d_St%d_C%d_F%d_P%d_%s"), NumBoids, FMath::RoundToInt(Spacing), NumStimuli,
+								   bCollision ? 1 : 0, bFollowFloor ? 1 : 0, bSpecialisedPipelines ? 1 : 0, GetBackendName(RenderBackend));
+		}
+
+		static const TCHAR* GetBackendName(EFlockRenderBackend Backend)
+		{
+			switch (Backend)
+			{
+			case EFlockRenderBackend::InstancedStaticMesh: return TEXT("ISM");
+			case EFlockRenderBackend::ChunkedInstancedStaticMesh: return TEXT("Chunked");
+			default: return TEXT("HISM");
+			}
+		}
+	};
+
+	struct FResult
+	{
+		FScenario Scenario;
+		int32 Frames = 0;
+		int32 FinalBoids = 0;
+		double FrameMs = 0.0;
+		double MaxFrameMs = 0.0;
+		FFlockStageTimings AverageTimings;
+		FFlockMemoryStats Memory;
+	};
+
+	template <typename ValueType>
+	TArray<ValueType> ParseList(const FString& Params, const TCHAR* Key, const TArray<ValueType>& Default)
+	{
+		FString Value;
+		if (!FParse::Value(*Params, Key, Value, false))
+		{
+			return Default;
+		}
+
+		TArray<FString> Tokens;
+		Value.ParseIntoArray(Tokens, TEXT(","));
+		TArray<ValueType> List;
+		for (const FString& Token : Tokens)
+		{
+			ValueType Parsed;
+			LexFromString(Parsed, *Token);
+			List.Add(Parsed);
+		}
+		return List.Num() > 0 ? List : Default;
+	}
+
+	void AccumulateTimings(FFlockStageTimings& Sum, const FFlockStageTimings& Timings)
+	{
+		Sum.OctreeMs += Timings.OctreeMs;
+		Sum.NeighbourhoodMs += Timings.NeighbourhoodMs;
+		Sum.SteeringMs += Timings.SteeringMs;
+		Sum.InstanceUploadMs += Timings.InstanceUploadMs;
+		Sum.CommandsMs += Timings.CommandsMs;
+		Sum.TotalMs += Timings.TotalMs;
+	}
+
+	void ScaleTimings(FFlockStageTimings& Timings, float Scale)
+	{
+		Timings.OctreeMs *= Scale;
+		Timings.NeighbourhoodMs *= Scale;
+		Timings.SteeringMs *= Scale;
+		Timings.InstanceUploadMs *= Scale;
+		Timings.CommandsMs *= Scale;
+		Timings.TotalMs *= Scale;
+	}
+}
+
+UFlockBenchmarkCommandlet::UFlockBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UFlockBenchmarkCommandlet::Main(const FString& Params)
+{
+	using namespace FlockBenchmark;
+
+	const TArray<int32> Sizes = ParseList<int32>(Params, TEXT("Sizes="), {500, 2000});
+	const TArray<float> Spacings = ParseList<float>(Params, TEXT("Spacings="), {150.0f});
+	const TArray<int32> StimuliCounts = ParseList<int32>(Params, TEXT("Stimuli="), {0, 8});
+	const TArray<int32> CollisionModes = ParseList<int32>(Params, TEXT("Collision="), {0, 1});
+	const TArray<int32> FollowFloorModes = ParseList<int32>(Params, TEXT("FollowFloor="), {0});
+	const TArray<int32> PipelineModes = ParseList<int32>(Params, TEXT("Pipelines="), {0, 1});
+	const TArray<FString> BackendNames = ParseList<FString>(Params, TEXT("RenderBackends="), {TEXT("HISM")});
+
+	TArray<EFlockRenderBackend> Backends;
+	for (const FString& BackendName : BackendNames)
+	{
+		const EFlockRenderBackend AllBackends[] = {
+			EFlockRenderBackend::InstancedStaticMesh,
+			EFlockRenderBackend::HierarchicalInstancedStaticMesh,
+			EFlockRenderBackend::ChunkedInstancedStaticMesh};
+		const EFlockRenderBackend* Backend = Algo::FindByPredicate(AllBackends, [&BackendName](EFlockRenderBackend Candidate)
+		{
+			return BackendName.Equals(FScenario::GetBackendName(Candidate), ESearchCase::IgnoreCase);
+		});
+		if (Backend == nullptr)
+		{
+			UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark: unknown render backend %s, use ISM, HISM or Chunked"), *BackendName);
+			return 1;
+		}
+		Backends.Add(*Backend);
+	}
+
+	int32 Frames = 300;
+	int32 WarmupFrames = 30;
+	float DeltaSeconds = 1.0f / 60.0f;
+	int32 Seed = 1;
+	FString MapName;
+	FString Output = FPaths::ProjectSavedDir() / TEXT("FlockBenchmark") / TEXT("FlockBenchmark");
+	FParse::Value(*Params, TEXT("Frames="), Frames);
+	FParse::Value(*Params, TEXT("Warmup="), WarmupFrames);
+	FParse::Value(*Params, TEXT("DeltaSeconds="), DeltaSeconds);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("Map="), MapName);
+	FParse::Value(*Params, TEXT("Output="), Output);
+
+	FString ClassPath;
+	if (FParse::Value(*Params, TEXT("AgentClass="), ClassPath))
+	{
+		AgentClass.SetPath(ClassPath);
+	}
+
+	if (Frames <= 0 || DeltaSeconds <= 0.0f)
+	{
+		UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark: Frames and DeltaSeconds must be positive"));
+		return 1;
+	}
+
+	UClass* AgentClassToSpawn = AgentClass.TryLoadClass<AAgent>();
+	if (AgentClassToSpawn == nullptr)
+	{
+		UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark: cannot load the agent class %s"), *AgentClass.ToString());
+		return 1;
+	}
+	UClass* PositiveClass = PositiveStimulusClass.TryLoadClass<AStimulus>();
+	UClass* NegativeClass = NegativeStimulusClass.TryLoadClass<AStimulus>();
+
+	// Every combination of the scripted values
+	TArray<FScenario> Scenarios;
+	const int32 NumScenarios = Sizes.Num() * Spacings.Num() * StimuliCounts.Num() * CollisionModes.Num() * FollowFloorModes.Num() * PipelineModes.Num() * Backends.Num();
+	for (int32 Combination = 0; Combination < NumScenarios; ++Combination)
+	{
+		int32 Remainder = Combination;
+		auto NextIndex = [&Remainder](int32 Count)
+		{
+			const int32 Index = Remainder % Count;
+			Remainder /= Count;
+			return Index;
+		};
+
+		FScenario& Scenario = Scenarios.AddDefaulted_GetRef();
+		Scenario.RenderBackend = Backends[NextIndex(Backends.Num())];
+		Scenario.bSpecialisedPipelines = PipelineModes[NextIndex(PipelineModes.Num())] != 0;
+		Scenario.bFollowFloor = FollowFloorModes[NextIndex(FollowFloorModes.Num())] != 0;
+		Scenario.bCollision = CollisionModes[NextIndex(CollisionModes.Num())] != 0;
+		Scenario.NumStimuli = StimuliCounts[NextIndex(StimuliCounts.Num())];
+		Scenario.Spacing = Spacings[NextIndex(Spacings.Num())];
+		Scenario.NumBoids = Sizes[NextIndex(Sizes.Num())];
+	}
+
+	// One world for every scenario, the map is only loaded once
+	UWorld* World = nullptr;
+	if (MapName.IsEmpty())
+	{
+		World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("FlockBenchmark"));
+	}
+	else
+	{
+		UPackage* MapPackage = LoadPackage(nullptr, *MapName, LOAD_None);
+		World = MapPackage ? UWorld::FindWorldInPackage(MapPackage) : nullptr;
+		if (World == nullptr)
+		{
+			UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark: cannot load the map %s"), *MapName);
+			return 1;
+		}
+		World->WorldType = EWorldType::Game;
+		World->AddToRoot();
+		if (!World->bIsWorldInitialized)
+		{
+			World->InitWorld(UWorld::InitializationValues().AllowAudioPlayback(false).CreatePhysicsScene(true));
+		}
+		World->UpdateWorldComponents(true, false);
+	}
+
+	// Without a game mode the world never begins play for its actors and the agents would never tick
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+	World->SetGameMode(FURL());
+	World->InitializeActorsForPlay(FURL());
+	World->BeginPlay();
+
+	TArray<FResult> Results;
+	bool bAllTicked = true;
+	for (const FScenario& Scenario : Scenarios)
+	{
+		// Deferred so the agent begins play with the scenario settings
+		AAgent* Agent = World->SpawnActorDeferred<AAgent>(AgentClassToSpawn, FTransform::Identity);
+		check(Agent);
+		Agent->RenderBackend = Scenario.RenderBackend;
+		Agent->Profiles.Reset();
+		if (!Scenario.bCollision)
+		{
+			Agent->DefaultSettings.CollisionWeight = 0.0f;
+		}
+		Agent->DefaultSettings.bFollowFloorZ = Scenario.bFollowFloor;
+		Agent->DefaultSettings.bReactToStimuli = Scenario.NumStimuli > 0;
+		Agent->bUseSpecialisedPipelines = Scenario.bSpecialisedPipelines;
+		Agent->DefaultSettings.bEnableDebugDraw = false;
+		Agent->FinishSpawning(FTransform::Identity);
+
+		// Boids start on a square grid over the floor, Spacing sets how many share a vision radius
+		FRandomStream Random(Seed);
+		const int32 Side = FMath::CeilToInt(FMath::Sqrt(static_cast<float>(Scenario.NumBoids)));
+		const float HalfSide = Side * Scenario.Spacing * 0.5f;
+		Agent->ReserveBoids(Scenario.NumBoids);
+		for (int32 Index = 0; Index < Scenario.NumBoids; ++Index)
+		{
+			const FVector Location(
+				(Index % Side) * Scenario.Spacing - HalfSide + Random.FRandRange(-0.25f, 0.25f) * Scenario.Spacing,
+				(Index / Side) * Scenario.Spacing - HalfSide + Random.FRandRange(-0.25f, 0.25f) * Scenario.Spacing,
+				100.0);
+			Agent->SpawnBoid(Location, FRotator(0.0, Random.FRandRange(-180.0f, 180.0f), 0.0));
+		}
+
+		TArray<AStimulus*> Stimuli;
+		for (int32 Index = 0; Index < Scenario.NumStimuli; ++Index)
+		{
+			UClass* StimulusClass = (Index % 2 == 0) ? PositiveClass : NegativeClass;
+			if (StimulusClass == nullptr)
+			{
+				continue;
+			}
+			const FVector Location(Random.FRandRange(-HalfSide, HalfSide), Random.FRandRange(-HalfSide, HalfSide), 100.0);
+			if (AStimulus* Stimulus = World->SpawnActor<AStimulus>(StimulusClass, FTransform(Location)))
+			{
+				Agent->AddGlobalStimulus(Stimulus);
+				Stimuli.Add(Stimulus);
+			}
+		}
+
+		FResult& Result = Results.AddDefaulted_GetRef();
+		Result.Scenario = Scenario;
+		for (int32 Frame = 0; Frame < WarmupFrames + Frames; ++Frame)
+		{
+			const double FrameStart = FPlatformTime::Seconds();
+			World->Tick(LEVELTICK_All, DeltaSeconds);
+			const double FrameMs = (FPlatformTime::Seconds() - FrameStart) * 1000.0;
+			if (Frame < WarmupFrames)
+			{
+				continue;
+			}
+
+			++Result.Frames;
+			Result.FrameMs += FrameMs;
+			Result.MaxFrameMs = FMath::Max(Result.MaxFrameMs, FrameMs);
+			AccumulateTimings(Result.AverageTimings, Agent->GetStageTimings());
+		}
+
+		Result.FrameMs /= Result.Frames;
+		ScaleTimings(Result.AverageTimings, 1.0f / Result.Frames);
+		Result.FinalBoids = Agent->GetNumBoids();
+		Result.Memory = Agent->GetMemoryStats();
+
+		UE_LOG(LogFlockAI, Display, TEXT("FlockBenchmark %s: %.3f ms/frame (max %.3f), agent %.3f ms, %.0f bytes/boid"),
+			   *Scenario.GetName(), Result.FrameMs, Result.MaxFrameMs, Result.AverageTimings.TotalMs, Result.Memory.BytesPerBoid);
+
+		// The spawns are applied by the first tick, an agent without boids never ticked
+		if (Result.FinalBoids == 0 || Result.AverageTimings.TotalMs <= 0.0f)
+		{
+			UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark %s: the agent did not simulate its boids"), *Scenario.GetName());
+			bAllTicked = false;
+		}
+
+		for (AStimulus* Stimulus : Stimuli)
+		{
+			// Consumed stimuli destroy themselves
+			if (IsValid(Stimulus))
+			{
+				Stimulus->Destroy();
+			}
+		}
+		Agent->Destroy();
+		CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+	}
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	World->RemoveFromRoot();
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	// JSON for the perf gate, CSV for spreadsheets
+	TArray<TSharedPtr<FJsonValue>> JsonResults;
+	FString Csv = TEXT("Scenario,Boids,Spacing,Stimuli,Collision,FollowFloor,SpecialisedPipelines,RenderBackend,Frames,FinalBoids,FrameMs,MaxFrameMs,")
+		TEXT("AgentMs,OctreeMs,NeighbourhoodMs,SteeringMs,InstanceUploadMs,CommandsMs,MemoryBytes,BytesPerBoid\n");
+	for (const FResult& Result : Results)
+	{
+		const FFlockStageTimings& Timings = Result.AverageTimings;
+		TSharedRef<FJsonObject> JsonResult = MakeShared<FJsonObject>();
+		JsonResult->SetStringField(TEXT("Scenario"), Result.Scenario.GetName());
+		JsonResult->SetNumberField(TEXT("Boids"), Result.Scenario.NumBoids);
+		JsonResult->SetNumberField(TEXT("Spacing"), Result.Scenario.Spacing);
+		JsonResult->SetNumberField(TEXT("Stimuli"), Result.Scenario.NumStimuli);
+		JsonResult->SetBoolField(TEXT("Collision"), Result.Scenario.bCollision);
+		JsonResult->SetBoolField(TEXT("FollowFloor"), Result.Scenario.bFollowFloor);
+		JsonResult->SetBoolField(TEXT("SpecialisedPipelines"), Result.Scenario.bSpecialisedPipelines);
+		JsonResult->SetStringField(TEXT("RenderBackend"), FScenario::GetBackendName(Result.Scenario.RenderBackend));
+		JsonResult->SetNumberField(TEXT("Frames"), Result.Frames);
+		JsonResult->SetNumberField(TEXT("FinalBoids"), Result.FinalBoids);
+		JsonResult->SetNumberField(TEXT("FrameMs"), Result.FrameMs);
+		JsonResult->SetNumberField(TEXT("MaxFrameMs"), Result.MaxFrameMs);
+		JsonResult->SetNumberField(TEXT("AgentMs"), Timings.TotalMs);
+		JsonResult->SetNumberField(TEXT("OctreeMs"), Timings.OctreeMs);
+		JsonResult->SetNumberField(TEXT("NeighbourhoodMs"), Timings.NeighbourhoodMs);
+		JsonResult->SetNumberField(TEXT("SteeringMs"), Timings.SteeringMs);
+		JsonResult->SetNumberField(TEXT("InstanceUploadMs"), Timings.InstanceUploadMs);
+		JsonResult->SetNumberField(TEXT("CommandsMs"), Timings.CommandsMs);
+		JsonResult->SetNumberField(TEXT("MemoryBytes"), static_cast<double>(Result.Memory.TotalBytes));
+		JsonResult->SetNumberField(TEXT("BytesPerBoid"), Result.Memory.BytesPerBoid);
+		JsonResults.Add(MakeShared<FJsonValueObject>(JsonResult));
+
+		Csv += FString::Printf(TEXT("%s,%d,%.1f,%d,%d,%d,%d,%s,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%lld,%.1f\n"),
+			*Result.Scenario.GetName(), Result.Scenario.NumBoids, Result.Scenario.Spacing, Result.Scenario.NumStimuli,
+			Result.Scenario.bCollision ? 1 : 0, Result.Scenario.bFollowFloor ? 1 : 0, Result.Scenario.bSpecialisedPipelines ? 1 : 0,
+			FScenario::GetBackendName(Result.Scenario.RenderBackend), Result.Frames, Result.FinalBoids,
+			Result.FrameMs, Result.MaxFrameMs, Timings.TotalMs, Timings.OctreeMs, Timings.NeighbourhoodMs,
+			Timings.SteeringMs, Timings.InstanceUploadMs, Timings.CommandsMs, Result.Memory.TotalBytes, Result.Memory.BytesPerBoid);
+	}
+
+	const TSharedRef<FJsonObject> JsonRoot = MakeShared<FJsonObject>();
+	JsonRoot->SetNumberField(TEXT("DeltaSeconds"), DeltaSeconds);
+	JsonRoot->SetNumberField(TEXT("Seed"), Seed);
+	JsonRoot->SetStringField(TEXT("Map"), MapName);
+	JsonRoot->SetArrayField(TEXT("Results"), JsonResults);
+
+	FString Json;
+	const TSharedRef<TJsonWriter<>> JsonWriter = TJsonWriterFactory<>::Create(&Json);
+	FJsonSerializer::Serialize(JsonRoot, JsonWriter);
+
+	const bool bSaved = FFileHelper::SaveStringToFile(Json, *(Output + TEXT(".json")))
+		&& FFileHelper::SaveStringToFile(Csv, *(Output + TEXT(".csv")));
+	if (!bSaved)
+	{
+		UE_LOG(LogFlockAI, Error, TEXT("FlockBenchmark: cannot write the results to %s"), *Output);
+		return 1;
+	}
+
+	UE_LOG(LogFlockAI, Display, TEXT("FlockBenchmark: %d scenarios written to %s.json/.csv"), Results.Num(), *Output);
+	return bAllTicked ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockDistanceField.h"
+
+#include "FlockAI.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "WorldCollision.h"
+
+namespace FlockDistanceField
+{
+	// Iterations of the sphere overlap search when the body cannot answer the distance itself
+	constexpr int32 OverlapSearchSteps = 5;
+}
+
+void UFlockDistanceField::Bake(UWorld* World, const FBox& InBounds, float InVoxelSize, float InMaxDistance,
+							   ECollisionChannel ObjectType, const AActor* IgnoredActor)
+{
+	check(World);
+	check(InVoxelSize > 0.0f && InMaxDistance > 0.0f);
+
+	Bounds = InBounds;
+	VoxelSize = InVoxelSize;
+	MaxDistance = InMaxDistance;
+	BrickIndices.Reset();
+	Distances.Reset();
+	Gradients.Reset();
+
+	const FVector Size = Bounds.GetSize();
+	NumVoxels = FIntVector(
+		FMath::CeilToInt(Size.X / VoxelSize) + 1,
+		FMath::CeilToInt(Size.Y / VoxelSize) + 1,
+		FMath::CeilToInt(Size.Z / VoxelSize) + 1);
+	NumBricks = FIntVector(
+		FMath::DivideAndRoundUp(NumVoxels.X, BrickSize),
+		FMath::DivideAndRoundUp(NumVoxels.Y, BrickSize),
+		FMath::DivideAndRoundUp(NumVoxels.Z, BrickSize));
+	BrickIndices.Init(INDEX_NONE, NumBricks.X * NumBricks.Y * NumBricks.Z);
+
+	static const FName BakeDistanceFieldName(TEXT("FlockBakeDistanceField"));
+	FCollisionQueryParams Params(BakeDistanceFieldName, false);
+	Params.AddIgnoredActor(IgnoredActor);
+	const FCollisionObjectQueryParams ObjectParams(ObjectType);
+
+	TArray<FOverlapResult> Overlaps;
+	TArray<UPrimitiveComponent*> Components;
+	float BrickDistances[BrickVoxels];
+	const double BrickLength = BrickSize * VoxelSize;
+
+	for (int32 BrickZ = 0; BrickZ < NumBricks.Z; ++BrickZ)
+	{
+		for (int32 BrickY = 0; BrickY < NumBricks.Y; ++BrickY)
+		{
+			for (int32 BrickX = 0; BrickX < NumBricks.X; ++BrickX)
+			{
+				const FVector BrickMin = Bounds.Min + FVector(BrickX, BrickY, BrickZ) * BrickLength;
+				const FBox BrickBox = FBox(BrickMin, BrickMin + FVector(BrickLength - VoxelSize)).ExpandBy(MaxDistance);
+
+				// Only the geometry close to the brick can affect its voxels
+				Overlaps.Reset();
+				World->OverlapMultiByObjectType(Overlaps, BrickBox.GetCenter(), FQuat::Identity, ObjectParams,
+												FCollisionShape::MakeBox(BrickBox.GetExtent()), Params);
+				Components.Reset();
+				for (const FOverlapResult& Overlap : Overlaps)
+				{
+					if (UPrimitiveComponent* Component = Overlap.GetComponent())
+					{
+						Components.AddUnique(Component);
+					}
+				}
+
+				if (Components.Num() == 0)
+				{
+					continue;
+				}
+
+				bool bAnyVoxelInRange = false;
+				for (int32 Voxel = 0; Voxel < BrickVoxels; ++Voxel)
+				{
+					const FIntVector Local(Voxel % BrickSize, (Voxel / BrickSize) % BrickSize, Voxel / (BrickSize * BrickSize));
+					const FVector Location = BrickMin + FVector(Local) * VoxelSize;
+					BrickDistances[Voxel] = BakeVoxel(World, Location, Components, ObjectType, Params);
+					bAnyVoxelInRange |= BrickDistances[Voxel] < MaxDistance;
+				}
+
+				if (!bAnyVoxelInRange)
+				{
+					continue;
+				}
+
+				const int32 BrickIndex = Distances.Num() / BrickVoxels;
+				BrickIndices[BrickX + NumBricks.X * (BrickY + NumBricks.Y * BrickZ)] = BrickIndex;
+				Distances.AddUninitialized(BrickVoxels);
+				Gradients.AddUninitialized(BrickVoxels * 3);
+
+				for (int32 Voxel = 0; Voxel < BrickVoxels; ++Voxel)
+				{
+					const int32 X = Voxel % BrickSize;
+					const int32 Y = (Voxel / BrickSize) % BrickSize;
+					const int32 Z = Voxel / (BrickSize * BrickSize);
+
+					// Central differences inside the brick, one sided on its borders
+					auto Difference = [&BrickDistances, Voxel](int32 Coordinate, int32 Stride)
+					{
+						const int32 Previous = Coordinate > 0 ? Voxel - Stride : Voxel;
+						const int32 Next = Coordinate < BrickSize - 1 ? Voxel + Stride : Voxel;
+						return BrickDistances[Next] - BrickDistances[Previous];
+					};
+					const FVector Gradient = FVector(
+						Difference(X, 1),
+						Difference(Y, BrickSize),
+						Difference(Z, BrickSize * BrickSize)).GetSafeNormal();
+
+					const int32 Offset = BrickIndex * BrickVoxels + Voxel;
+					Distances[Offset] = static_cast<uint8>(FMath::RoundToInt(BrickDistances[Voxel] / MaxDistance * 255.0f));
+					Gradients[Offset * 3 + 0] = static_cast<int8>(FMath::RoundToInt(Gradient.X * 127.0));
+					Gradients[Offset * 3 + 1] = static_cast<int8>(FMath::RoundToInt(Gradient.Y * 127.0));
+					Gradients[Offset * 3 + 2] = static_cast<int8>(FMath::RoundToInt(Gradient.Z * 127.0));
+				}
+			}
+		}
+	}
+
+	UE_LOG(LogFlockAI, Log, TEXT("Baked flock distance field %s: %d of %d bricks, %d KB"),
+		   *GetName(), Distances.Num() / BrickVoxels, BrickIndices.Num(),
+		   static_cast<int32>((Distances.Num() + Gradients.Num() + BrickIndices.Num() * sizeof(int32)) / 1024));
+}
+
+float UFlockDistanceField::BakeVoxel(UWorld* World, const FVector& Location, const TArray<UPrimitiveComponent*>& Components,
+									 ECollisionChannel ObjectType, const FCollisionQueryParams& Params) const
+{
+	float Distance = MaxDistance;
+	bool bAllBodiesAnswered = true;
+	for (const UPrimitiveComponent* Component : Components)
+	{
+		FVector ClosestPoint;
+		const float ComponentDistance = Component->GetDistanceToCollision(Location, ClosestPoint);
+		if (ComponentDistance < 0.0f)
+		{
+			bAllBodiesAnswered = false;
+			continue;
+		}
+		Distance = FMath::Min(Distance, ComponentDistance);
+	}
+
+	if (bAllBodiesAnswered)
+	{
+		return Distance;
+	}
+
+	// Some shapes (heightfields, complex meshes) do not support point queries, bisect with sphere overlaps
+	const FCollisionObjectQueryParams ObjectParams(ObjectType);
+	float Inside = 0.0f;
+	float Outside = Distance;
+	if (!World->OverlapAnyTestByObjectType(Location, FQuat::Identity, ObjectParams, FCollisionShape::MakeSphere(Outside), Params))
+	{
+		return Distance;
+	}
+
+	for (int32 Step = 0; Step < FlockDistanceField::OverlapSearchSteps; ++Step)
+	{
+		const float Radius = (Inside + Outside) * 0.5f;
+		if (World->OverlapAnyTestByObjectType(Location, FQuat::Identity, ObjectParams, FCollisionShape::MakeSphere(Radius), Params))
+		{
+			Outside = Radius;
+		}
+		else
+		{
+			Inside = Radius;
+		}
+	}
+
+	return (Inside + Outside) * 0.5f;
+}
+
+void UFlockDistanceField::FetchVoxel(int32 X, int32 Y, int32 Z, float& OutDistance, FVector& OutGradient) const
+{
+	const int32 BrickIndex = BrickIndices[X / BrickSize + NumBricks.X * (Y / BrickSize + NumBricks.Y * (Z / BrickSize))];
+	if (BrickIndex == INDEX_NONE)
+	{
+		OutDistance = MaxDistance;
+		OutGradient = FVector::ZeroVector;
+		return;
+	}
+
+	const int32 Offset = BrickIndex * BrickVoxels
+		+ X % BrickSize + BrickSize * (Y % BrickSize + BrickSize * (Z % BrickSize));
+	OutDistance = Distances[Offset] * (MaxDistance / 255.0f);
+	OutGradient = FVector(Gradients[Offset * 3 + 0], Gradients[Offset * 3 + 1], Gradients[Offset * 3 + 2]) / 127.0;
+}
+
+bool UFlockDistanceField::Sample(const FVector& Location, float& OutDistance, FVector& OutGradient) const
+{
+	if (!IsBaked())
+	{
+		return false;
+	}
+
+	const FVector VoxelLocation = (Location - Bounds.Min) / VoxelSize;
+	if (VoxelLocation.X < 0.0 || VoxelLocation.Y < 0.0 || VoxelLocation.Z < 0.0
+		|| VoxelLocation.X >= NumVoxels.X - 1 || VoxelLocation.Y >= NumVoxels.Y - 1 || VoxelLocation.Z >= NumVoxels.Z - 1)
+	{
+		return false;
+	}
+
+	const int32 X = FMath::FloorToInt(VoxelLocation.X);
+	const int32 Y = FMath::FloorToInt(VoxelLocation.Y);
+	const int32 Z = FMath::FloorToInt(VoxelLocation.Z);
+	const FVector Alpha = VoxelLocation - FVector(X, Y, Z);
+
+	OutDistance = 0.0f;
+	OutGradient = FVector::ZeroVector;
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const int32 DX = Corner & 1;
+		const int32 DY = (Corner >> 1) & 1;
+		const int32 DZ = (Corner >> 2) & 1;
+		const float Weight = static_cast<float>(
+			(DX ? Alpha.X : 1.0 - Alpha.X) * (DY ? Alpha.Y : 1.0 - Alpha.Y) * (DZ ? Alpha.Z : 1.0 - Alpha.Z));
+
+		float CornerDistance;
+		FVector CornerGradient;
+		FetchVoxel(X + DX, Y + DY, Z + DZ, CornerDistance, CornerGradient);
+		OutDistance += CornerDistance * Weight;
+		OutGradient += CornerGradient * Weight;
+	}
+
+	return true;
+}
+
+SIZE_T UFlockDistanceField::GetAllocatedSize() const
+{
+	return BrickIndices.GetAllocatedSize() + Distances.GetAllocatedSize() + Gradients.GetAllocatedSize();
+}
@@ -0,0 +1,290 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockFlowField.h"
+
+#include "FlockAI.h"
+#include "Algo/Count.h"
+#include "Engine/World.h"
+
+namespace FlockFlowField
+{
+	// The 8 neighbours of a cell, counter clockwise from +X, the opposite of N is (N + 4) % 8
+	constexpr int32 NumNeighbours = 8;
+	constexpr int32 NeighbourX[NumNeighbours] = {1, 1, 0, -1, -1, -1, 0, 1};
+	constexpr int32 NeighbourY[NumNeighbours] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+	// Direction values that are not a neighbour
+	constexpr uint8 AtGoal = NumNeighbours;
+	constexpr uint8 Unreachable = MAX_uint8;
+
+	// Extra cost of a cell at the maximum slope, over the cost of flat ground
+	constexpr float SlopeCost = 4.0f;
+}
+
+void UFlockFlowField::Bake(UWorld* World, const FBox& InBounds, float InCellSize, float InMaxSlopeAngle,
+						   ECollisionChannel Channel, const AActor* IgnoredActor)
+{
+	check(World);
+	check(InCellSize > 0.0f);
+
+	Bounds = InBounds;
+	CellSize = InCellSize;
+	MaxSlopeAngle = InMaxSlopeAngle;
+	NumCells = FIntPoint(
+		FMath::Max(FMath::CeilToInt(Bounds.GetSize().X / CellSize), 1),
+		FMath::Max(FMath::CeilToInt(Bounds.GetSize().Y / CellSize), 1));
+	Heights.SetNumUninitialized(NumCells.X * NumCells.Y);
+	CellCosts.SetNumUninitialized(NumCells.X * NumCells.Y);
+	Goals.Reset();
+	RequestedGoals.Reset();
+
+	static const FName BakeFlowFieldName(TEXT("FlockBakeFlowField"));
+	FCollisionQueryParams Params(BakeFlowFieldName, false);
+	Params.AddIgnoredActor(IgnoredActor);
+	for (int32 Y = 0; Y < NumCells.Y; ++Y)
+	{
+		for (int32 X = 0; X < NumCells.X; ++X)
+		{
+			BakeCell(World, X, Y, Channel, Params);
+		}
+	}
+
+	UE_LOG(LogFlockAI, Log, TEXT("Baked flock flow field %s: %d x %d cells, %d blocked"),
+		   *GetName(), NumCells.X, NumCells.Y, static_cast<int32>(Algo::Count(CellCosts, 0)));
+}
+
+void UFlockFlowField::UpdateRegion(UWorld* World, const FBox& Region, ECollisionChannel Channel, const AActor* IgnoredActor)
+{
+	check(World);
+	if (!IsBaked() || !Region.IsValid || !Region.Intersect(Bounds))
+	{
+		return;
+	}
+
+	static const FName UpdateFlowFieldName(TEXT("FlockUpdateFlowField"));
+	FCollisionQueryParams Params(UpdateFlowFieldName, false);
+	Params.AddIgnoredActor(IgnoredActor);
+	const FVector Min = (Region.Min - Bounds.Min) / CellSize;
+	const FVector Max = (Region.Max - Bounds.Min) / CellSize;
+	for (int32 Y = FMath::Max(FMath::FloorToInt32(Min.Y), 0); Y <= FMath::Min(FMath::FloorToInt32(Max.Y), NumCells.Y - 1); ++Y)
+	{
+		for (int32 X = FMath::Max(FMath::FloorToInt32(Min.X), 0); X <= FMath::Min(FMath::FloorToInt32(Max.X), NumCells.X - 1); ++X)
+		{
+			BakeCell(World, X, Y, Channel, Params);
+		}
+	}
+
+	// UpdateGoals restarts the sweeps a few at a time
+	for (TPair<FIntPoint, FGoal>& Goal : Goals)
+	{
+		Goal.Value.bNeedsSweep = true;
+	}
+}
+
+void UFlockFlowField::BakeCell(UWorld* World, int32 X, int32 Y, ECollisionChannel Channel, const FCollisionQueryParams& Params)
+{
+	const int32 Index = X + NumCells.X * Y;
+	const FVector2D Center = FVector2D(Bounds.Min) + (FVector2D(X, Y) + 0.5) * CellSize;
+
+	FHitResult Hit;
+	if (!World->LineTraceSingleByChannel(Hit, FVector(Center, Bounds.Max.Z), FVector(Center, Bounds.Min.Z), Channel, Params))
+	{
+		Heights[Index] = static_cast<float>(Bounds.Min.Z);
+		CellCosts[Index] = 0;
+		return;
+	}
+
+	const float Slope = FMath::RadiansToDegrees(FMath::Acos(FMath::Clamp(static_cast<float>(Hit.ImpactNormal.Z), -1.0f, 1.0f)));
+	Heights[Index] = static_cast<float>(Hit.ImpactPoint.Z);
+	CellCosts[Index] = Slope > MaxSlopeAngle
+		? 0
+		: static_cast<uint8>(1 + FMath::RoundToInt32(Slope / FMath::Max(MaxSlopeAngle, 1.0f) * FlockFlowField::SlopeCost));
+}
+
+int32 UFlockFlowField::GetCellIndex(const FVector& Location) const
+{
+	const int32 X = FMath::FloorToInt32((Location.X - Bounds.Min.X) / CellSize);
+	const int32 Y = FMath::FloorToInt32((Location.Y - Bounds.Min.Y) / CellSize);
+	if (X < 0 || Y < 0 || X >= NumCells.X || Y >= NumCells.Y)
+	{
+		return INDEX_NONE;
+	}
+	return X + NumCells.X * Y;
+}
+
+bool UFlockFlowField::SampleDirection(const FVector& Goal, const FVector& Location, FVector3f& OutDirection)
+{
+	using namespace FlockFlowField;
+
+	const int32 GoalIndex = GetCellIndex(Goal);
+	const int32 Index = GetCellIndex(Location);
+	if (GoalIndex == INDEX_NONE || Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	const FIntPoint GoalCell(GoalIndex % NumCells.X, GoalIndex / NumCells.X);
+	FGoal* CachedGoal = Goals.Find(GoalCell);
+	if (CachedGoal == nullptr)
+	{
+		// The cache only changes in UpdateGoals, the boids of a tick cannot evict each other goals
+		RequestedGoals.Add(GoalCell);
+		return false;
+	}
+
+	CachedGoal->LastUsedUpdate = UpdateCount;
+	if (CachedGoal->Directions.Num() == 0)
+	{
+		return false;
+	}
+
+	const uint8 Neighbour = CachedGoal->Directions[Index];
+	if (Neighbour >= NumNeighbours)
+	{
+		return false;
+	}
+
+	OutDirection = FVector3f(NeighbourX[Neighbour], NeighbourY[Neighbour], 0.0f).GetUnsafeNormal();
+	return true;
+}
+
+void UFlockFlowField::UpdateGoals(int32 MaxCells)
+{
+	for (const FIntPoint& GoalCell : RequestedGoals)
+	{
+		// Make room for the new goal with one no boid sampled since the last update, otherwise it waits
+		if (Goals.Num() >= MaxCachedGoals)
+		{
+			FIntPoint LeastRecentlyUsed = GoalCell;
+			uint32 OldestUpdate = UpdateCount;
+			for (const TPair<FIntPoint, FGoal>& Cached : Goals)
+			{
+				if (Cached.Value.LastUsedUpdate < OldestUpdate)
+				{
+					OldestUpdate = Cached.Value.LastUsedUpdate;
+					LeastRecentlyUsed = Cached.Key;
+				}
+			}
+
+			if (OldestUpdate == UpdateCount)
+			{
+				break;
+			}
+			Goals.Remove(LeastRecentlyUsed);
+		}
+
+		Goals.Add(GoalCell).LastUsedUpdate = UpdateCount;
+	}
+	RequestedGoals.Reset();
+	++UpdateCount;
+
+	int32 NumStarts = 0;
+	for (TPair<FIntPoint, FGoal>& Goal : Goals)
+	{
+		if (Goal.Value.bNeedsSweep && NumStarts < MaxSweepStartsPerUpdate)
+		{
+			StartSweep(Goal.Key, Goal.Value);
+			++NumStarts;
+		}
+
+		if (Goal.Value.bSweeping && MaxCells > 0)
+		{
+			MaxCells -= StepSweep(Goal.Value, MaxCells);
+		}
+	}
+}
+
+void UFlockFlowField::StartSweep(const FIntPoint& GoalCell, FGoal& Goal) const
+{
+	using namespace FlockFlowField;
+
+	const int32 NumCellsTotal = NumCells.X * NumCells.Y;
+	const int32 GoalIndex = GoalCell.X + NumCells.X * GoalCell.Y;
+	Goal.Costs.Init(TNumericLimits<float>::Max(), NumCellsTotal);
+	Goal.PendingDirections.Init(Unreachable, NumCellsTotal);
+	Goal.Costs[GoalIndex] = 0.0f;
+	Goal.PendingDirections[GoalIndex] = AtGoal;
+	Goal.Open.Reset();
+	Goal.Open.Emplace(0.0f, GoalIndex);
+	Goal.bSweeping = true;
+	Goal.bNeedsSweep = false;
+}
+
+int32 UFlockFlowField::StepSweep(FGoal& Goal, int32 MaxCells) const
+{
+	using namespace FlockFlowField;
+
+	auto CheaperFirst = [](const TPair<float, int32>& A, const TPair<float, int32>& B) { return A.Key < B.Key; };
+
+	// Steps between neighbours higher than the max slope over a cell are walls
+	const float MaxStepHeight = CellSize * FMath::Tan(FMath::DegreesToRadians(MaxSlopeAngle));
+	int32 Settled = 0;
+	while (Goal.Open.Num() > 0 && Settled < MaxCells)
+	{
+		TPair<float, int32> Top;
+		Goal.Open.HeapPop(Top, CheaperFirst, false);
+		const int32 Cell = Top.Value;
+		if (Top.Key > Goal.Costs[Cell])
+		{
+			continue;
+		}
+		++Settled;
+
+		const int32 X = Cell % NumCells.X;
+		const int32 Y = Cell / NumCells.X;
+		for (int32 Neighbour = 0; Neighbour < NumNeighbours; ++Neighbour)
+		{
+			const int32 NX = X + NeighbourX[Neighbour];
+			const int32 NY = Y + NeighbourY[Neighbour];
+			if (NX < 0 || NY < 0 || NX >= NumCells.X || NY >= NumCells.Y)
+			{
+				continue;
+			}
+
+			const int32 Next = NX + NumCells.X * NY;
+			const bool bDiagonal = NeighbourX[Neighbour] != 0 && NeighbourY[Neighbour] != 0;
+			const float Length = bDiagonal ? UE_SQRT_2 : 1.0f;
+			const float StepHeight = FMath::Abs(Heights[Next] - Heights[Cell]);
+			if (CellCosts[Next] == 0 || StepHeight > MaxStepHeight * Length)
+			{
+				continue;
+			}
+
+			// Diagonals do not cut the corners of blocked cells
+			if (bDiagonal && (CellCosts[NX + NumCells.X * Y] == 0 || CellCosts[X + NumCells.X * NY] == 0))
+			{
+				continue;
+			}
+
+			const float Cost = Top.Key + Length * 0.5f * (CellCosts[Cell] + CellCosts[Next]) + StepHeight / CellSize;
+			if (Cost < Goal.Costs[Next])
+			{
+				Goal.Costs[Next] = Cost;
+				// The boids in Next move back toward Cell
+				Goal.PendingDirections[Next] = static_cast<uint8>((Neighbour + NumNeighbours / 2) % NumNeighbours);
+				Goal.Open.HeapPush(TPair<float, int32>(Cost, Next), CheaperFirst);
+			}
+		}
+	}
+
+	if (Goal.Open.Num() == 0)
+	{
+		Goal.Directions = MoveTemp(Goal.PendingDirections);
+		Goal.PendingDirections.Empty();
+		Goal.Costs.Empty();
+		Goal.bSweeping = false;
+	}
+
+	return Settled;
+}
+
+SIZE_T UFlockFlowField::GetAllocatedSize() const
+{
+	SIZE_T Size = Heights.GetAllocatedSize() + CellCosts.GetAllocatedSize() + Goals.GetAllocatedSize() + RequestedGoals.GetAllocatedSize();
+	for (const TPair<FIntPoint, FGoal>& Goal : Goals)
+	{
+		Size += Goal.Value.Directions.GetAllocatedSize() + Goal.Value.PendingDirections.GetAllocatedSize()
+			+ Goal.Value.Costs.GetAllocatedSize() + Goal.Value.Open.GetAllocatedSize();
+	}
+	return Size;
+}
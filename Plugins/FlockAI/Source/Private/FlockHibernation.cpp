@@ -0,0 +1,82 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockHibernation.h"
+
+void FFlockHibernationSummary::Build(TArrayView<const FVector> Locations, TArrayView<const FVector3f> Headings, TArrayView<const uint8> ProfileIndices)
+{
+	using namespace FlockHibernation;
+
+	check(Locations.Num() == Headings.Num() && Locations.Num() == ProfileIndices.Num());
+
+	Count = Locations.Num();
+	Bounds = FBox(ForceInit);
+	CellCounts.Init(0, NumCells);
+	ProfileCounts.Reset();
+
+	FVector LocationSum = FVector::ZeroVector;
+	FVector3f HeadingSum = FVector3f::ZeroVector;
+	for (int32 Index = 0; Index < Count; ++Index)
+	{
+		Bounds += Locations[Index];
+		LocationSum += Locations[Index];
+		HeadingSum += Headings[Index].GetSafeNormal();
+		if (!ProfileCounts.IsValidIndex(ProfileIndices[Index]))
+		{
+			ProfileCounts.SetNumZeroed(ProfileIndices[Index] + 1);
+		}
+		++ProfileCounts[ProfileIndices[Index]];
+	}
+
+	if (Count == 0)
+	{
+		return;
+	}
+
+	Centroid = LocationSum / Count;
+	Heading = HeadingSum.GetSafeNormal(UE_KINDA_SMALL_NUMBER, FVector3f::ForwardVector);
+
+	const FVector CellSize = Bounds.GetSize().ComponentMax(FVector::OneVector) / GridSize;
+	for (const FVector& Location : Locations)
+	{
+		const FVector Cell = (Location - Bounds.Min) / CellSize;
+		const int32 X = FMath::Clamp(FMath::FloorToInt32(Cell.X), 0, GridSize - 1);
+		const int32 Y = FMath::Clamp(FMath::FloorToInt32(Cell.Y), 0, GridSize - 1);
+		const int32 Z = FMath::Clamp(FMath::FloorToInt32(Cell.Z), 0, GridSize - 1);
+		uint16& CellCount = CellCounts[X + GridSize * (Y + GridSize * Z)];
+		CellCount = static_cast<uint16>(FMath::Min<int32>(CellCount + 1, MAX_uint16));
+	}
+}
+
+bool FFlockHibernationSummary::PopBoid(FVector& OutLocation, FRotator& OutRotation, uint8& OutProfileIndex)
+{
+	using namespace FlockHibernation;
+
+	if (Count <= 0)
+	{
+		return false;
+	}
+	--Count;
+
+	// Boids beyond the capacity of a cell come back at the centroid
+	OutLocation = Centroid;
+	const int32 Cell = CellCounts.IndexOfByPredicate([](uint16 CellCount) { return CellCount > 0; });
+	if (Cell != INDEX_NONE)
+	{
+		--CellCounts[Cell];
+		const FVector CellSize = Bounds.GetSize().ComponentMax(FVector::OneVector) / GridSize;
+		const FVector CellMin = Bounds.Min + FVector(Cell % GridSize, (Cell / GridSize) % GridSize, Cell / (GridSize * GridSize)) * CellSize;
+		OutLocation = CellMin + CellSize * FVector(FMath::FRand(), FMath::FRand(), FMath::FRand());
+	}
+
+	OutProfileIndex = 0;
+	const int32 Profile = ProfileCounts.IndexOfByPredicate([](int32 ProfileCount) { return ProfileCount > 0; });
+	if (Profile != INDEX_NONE)
+	{
+		--ProfileCounts[Profile];
+		OutProfileIndex = static_cast<uint8>(Profile);
+	}
+
+	OutRotation = FVector(Heading).Rotation();
+	OutRotation.Yaw += FMath::FRandRange(-HeadingSpread, HeadingSpread);
+	return true;
+}
@@ -0,0 +1,416 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockOctree.h"
+
+namespace FlockOctree
+{
+	constexpr float Sqrt3 = 1.7320508f;
+}
+
+void FFlockOctree::Reset()
+{
+	Nodes.Reset();
+	SortedSlots.Reset();
+	SortedLocations.Reset();
+	SortedHeadings.Reset();
+}
+
+void FFlockOctree::Reserve(int32 NumItems)
+{
+	Nodes.Reserve(2 * FMath::DivideAndRoundUp(NumItems, MaxLeafItems));
+	SortedSlots.Reserve(NumItems);
+	SortedLocations.Reserve(NumItems);
+	SortedHeadings.Reserve(NumItems);
+	PartitionSlots.Reserve(NumItems);
+	PartitionLocations.Reserve(NumItems);
+	PartitionHeadings.Reserve(NumItems);
+}
+
+SIZE_T FFlockOctree::GetAllocatedSize() const
+{
+	return Nodes.GetAllocatedSize() + SortedSlots.GetAllocatedSize() + SortedLocations.GetAllocatedSize()
+		+ SortedHeadings.GetAllocatedSize() + PartitionSlots.GetAllocatedSize() + PartitionLocations.GetAllocatedSize()
+		+ PartitionHeadings.GetAllocatedSize();
+}
+
+void FFlockOctree::Build(TArrayView<const FVector3f> Locations, TArrayView<const FVector3f> Headings)
+{
+	check(Locations.Num() == Headings.Num());
+	Reset();
+
+	const int32 Count = Locations.Num();
+	if (Count == 0)
+	{
+		return;
+	}
+
+	SortedSlots.SetNumUninitialized(Count, false);
+	SortedLocations.SetNumUninitialized(Count, false);
+	SortedHeadings.SetNumUninitialized(Count, false);
+
+	FBox3f Bounds(ForceInit);
+	for (int32 Slot = 0; Slot < Count; ++Slot)
+	{
+		SortedSlots[Slot] = Slot;
+		SortedLocations[Slot] = Locations[Slot];
+		SortedHeadings[Slot] = Headings[Slot].GetSafeNormal();
+		Bounds += Locations[Slot];
+	}
+
+	FNode& Root = Nodes.AddDefaulted_GetRef();
+	Root.Center = Bounds.GetCenter();
+	Root.HalfSize = FMath::Max(Bounds.GetExtent().GetMax(), 1.0f);
+	Root.FirstItem = 0;
+	Root.NumItems = Count;
+
+	BuildNode(0, 0);
+}
+
+void FFlockOctree::BuildNode(int32 NodeIndex, int32 Depth)
+{
+	// Nodes can grow while building the children, work on a copy
+	const FNode Node = Nodes[NodeIndex];
+	const int32 LastItem = Node.FirstItem + Node.NumItems;
+
+	if (Node.NumItems <= MaxLeafItems || Depth >= MaxDepth)
+	{
+		FVector3f LocationSum = FVector3f::ZeroVector;
+		FVector3f HeadingSum = FVector3f::ZeroVector;
+		for (int32 Item = Node.FirstItem; Item < LastItem; ++Item)
+		{
+			LocationSum += SortedLocations[Item];
+			HeadingSum += SortedHeadings[Item];
+		}
+
+		Nodes[NodeIndex].Centroid = LocationSum / Node.NumItems;
+		Nodes[NodeIndex].HeadingSum = HeadingSum;
+		return;
+	}
+
+	auto GetOctant = [&Node](const FVector3f& Location)
+	{
+		return (Location.X >= Node.Center.X ? 1 : 0)
+			| (Location.Y >= Node.Center.Y ? 2 : 0)
+			| (Location.Z >= Node.Center.Z ? 4 : 0);
+	};
+
+	// Counting sort of the node items by octant
+	int32 OctantCounts[8] = {0};
+	for (int32 Item = Node.FirstItem; Item < LastItem; ++Item)
+	{
+		++OctantCounts[GetOctant(SortedLocations[Item])];
+	}
+
+	int32 OctantCursor[8];
+	int32 Start = Node.FirstItem;
+	for (int32 Octant = 0; Octant < 8; ++Octant)
+	{
+		OctantCursor[Octant] = Start;
+		Start += OctantCounts[Octant];
+	}
+
+	PartitionSlots.SetNumUninitialized(Node.NumItems, false);
+	PartitionLocations.SetNumUninitialized(Node.NumItems, false);
+	PartitionHeadings.SetNumUninitialized(Node.NumItems, false);
+	FMemory::Memcpy(PartitionSlots.GetData(), &SortedSlots[Node.FirstItem], Node.NumItems * sizeof(int32));
+	FMemory::Memcpy(PartitionLocations.GetData(), &SortedLocations[Node.FirstItem], Node.NumItems * sizeof(FVector3f));
+	FMemory::Memcpy(PartitionHeadings.GetData(), &SortedHeadings[Node.FirstItem], Node.NumItems * sizeof(FVector3f));
+
+	for (int32 Index = 0; Index < Node.NumItems; ++Index)
+	{
+		const int32 Destination = OctantCursor[GetOctant(PartitionLocations[Index])]++;
+		SortedSlots[Destination] = PartitionSlots[Index];
+		SortedLocations[Destination] = PartitionLocations[Index];
+		SortedHeadings[Destination] = PartitionHeadings[Index];
+	}
+
+	// Children of a node are stored contiguously, empty octants are skipped
+	const float ChildHalfSize = Node.HalfSize * 0.5f;
+	const int32 FirstChild = Nodes.Num();
+	int32 ChildFirstItem = Node.FirstItem;
+	for (int32 Octant = 0; Octant < 8; ++Octant)
+	{
+		if (OctantCounts[Octant] == 0)
+		{
+			continue;
+		}
+
+		FNode& Child = Nodes.AddDefaulted_GetRef();
+		Child.Center = Node.Center + FVector3f(
+			(Octant & 1) ? ChildHalfSize : -ChildHalfSize,
+			(Octant & 2) ? ChildHalfSize : -ChildHalfSize,
+			(Octant & 4) ? ChildHalfSize : -ChildHalfSize);
+		Child.HalfSize = ChildHalfSize;
+		Child.FirstItem = ChildFirstItem;
+		Child.NumItems = OctantCounts[Octant];
+		ChildFirstItem += OctantCounts[Octant];
+	}
+
+	const int32 NumChildren = Nodes.Num() - FirstChild;
+	Nodes[NodeIndex].FirstChild = FirstChild;
+	Nodes[NodeIndex].NumChildren = NumChildren;
+
+	FVector3f LocationSum = FVector3f::ZeroVector;
+	FVector3f HeadingSum = FVector3f::ZeroVector;
+	for (int32 Child = FirstChild; Child < FirstChild + NumChildren; ++Child)
+	{
+		BuildNode(Child, Depth + 1);
+		LocationSum += Nodes[Child].Centroid * Nodes[Child].NumItems;
+		HeadingSum += Nodes[Child].HeadingSum;
+	}
+
+	Nodes[NodeIndex].Centroid = LocationSum / Node.NumItems;
+	Nodes[NodeIndex].HeadingSum = HeadingSum;
+}
+
+void FFlockOctree::AccumulateFarField(const FVector3f& Location, float NearRadius, float FarRadius, float OpeningAngle, FFlockFarFieldSample& OutSample) const
+{
+	if (Nodes.Num() == 0 || FarRadius <= NearRadius)
+	{
+		return;
+	}
+
+	const float NearRadiusSquared = FMath::Square(NearRadius);
+	const float FarRadiusSquared = FMath::Square(FarRadius);
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+		const float BoundingRadius = Node.HalfSize * FlockOctree::Sqrt3;
+		const float DistanceToCenter = FVector3f::Dist(Location, Node.Center);
+
+		// Fully out of range or fully inside the vision radius (the neighbourhood already counts those)
+		if (DistanceToCenter - BoundingRadius > FarRadius || DistanceToCenter + BoundingRadius <= NearRadius)
+		{
+			continue;
+		}
+
+		if (DistanceToCenter - BoundingRadius > NearRadius)
+		{
+			const float DistanceToCentroid = FVector3f::Dist(Location, Node.Centroid);
+			if (2.0f * Node.HalfSize < OpeningAngle * DistanceToCentroid)
+			{
+				if (DistanceToCentroid <= FarRadius)
+				{
+					OutSample.Count += Node.NumItems;
+					OutSample.LocationSum += Node.Centroid * Node.NumItems;
+					OutSample.HeadingSum += Node.HeadingSum;
+				}
+				continue;
+			}
+		}
+
+		if (Node.IsLeaf())
+		{
+			for (int32 Item = Node.FirstItem; Item < Node.FirstItem + Node.NumItems; ++Item)
+			{
+				const float DistanceSquared = FVector3f::DistSquared(Location, SortedLocations[Item]);
+				if (DistanceSquared > NearRadiusSquared && DistanceSquared <= FarRadiusSquared)
+				{
+					++OutSample.Count;
+					OutSample.LocationSum += SortedLocations[Item];
+					OutSample.HeadingSum += SortedHeadings[Item];
+				}
+			}
+			continue;
+		}
+
+		for (int32 Child = Node.FirstChild; Child < Node.FirstChild + Node.NumChildren; ++Child)
+		{
+			Stack.Add(Child);
+		}
+	}
+}
+
+void FFlockOctree::QuerySphere(const FVector3f& Center, float Radius, TArray<int32>& OutSlots) const
+{
+	if (Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	const float RadiusSquared = FMath::Square(Radius);
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+		const float BoundingRadius = Node.HalfSize * FlockOctree::Sqrt3;
+		const float DistanceToCenter = FVector3f::Dist(Center, Node.Center);
+		if (DistanceToCenter - BoundingRadius > Radius)
+		{
+			continue;
+		}
+
+		// The whole cell is inside the sphere, no need to test its boids
+		if (DistanceToCenter + BoundingRadius <= Radius)
+		{
+			OutSlots.Append(&SortedSlots[Node.FirstItem], Node.NumItems);
+			continue;
+		}
+
+		if (Node.IsLeaf())
+		{
+			for (int32 Item = Node.FirstItem; Item < Node.FirstItem + Node.NumItems; ++Item)
+			{
+				if (FVector3f::DistSquared(Center, SortedLocations[Item]) <= RadiusSquared)
+				{
+					OutSlots.Add(SortedSlots[Item]);
+				}
+			}
+			continue;
+		}
+
+		for (int32 Child = Node.FirstChild; Child < Node.FirstChild + Node.NumChildren; ++Child)
+		{
+			Stack.Add(Child);
+		}
+	}
+}
+
+void FFlockOctree::QueryBox(const FBox3f& Box, TArray<int32>& OutSlots) const
+{
+	if (Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+		const FBox3f Cell(Node.Center - FVector3f(Node.HalfSize), Node.Center + FVector3f(Node.HalfSize));
+		if (!Box.Intersect(Cell))
+		{
+			continue;
+		}
+
+		if (Box.IsInside(Cell))
+		{
+			OutSlots.Append(&SortedSlots[Node.FirstItem], Node.NumItems);
+			continue;
+		}
+
+		if (Node.IsLeaf())
+		{
+			for (int32 Item = Node.FirstItem; Item < Node.FirstItem + Node.NumItems; ++Item)
+			{
+				if (Box.IsInsideOrOn(SortedLocations[Item]))
+				{
+					OutSlots.Add(SortedSlots[Item]);
+				}
+			}
+			continue;
+		}
+
+		for (int32 Child = Node.FirstChild; Child < Node.FirstChild + Node.NumChildren; ++Child)
+		{
+			Stack.Add(Child);
+		}
+	}
+}
+
+void FFlockOctree::QueryNearest(const FVector3f& Center, int32 Count, float MaxRadius, TArray<int32>& OutSlots,
+								TFunctionRef<bool(int32 Slot)> IsSlotValid) const
+{
+	if (Nodes.Num() == 0 || Count <= 0)
+	{
+		return;
+	}
+
+	// Best first: the cells by their distance to Center, the found boids in a max heap of the Count closest
+	using FEntry = TPair<float, int32>;
+	auto CloserFirst = [](const FEntry& A, const FEntry& B) { return A.Key < B.Key; };
+	auto FartherFirst = [](const FEntry& A, const FEntry& B) { return A.Key > B.Key; };
+	TArray<FEntry, TInlineAllocator<64>> Cells;
+	TArray<FEntry, TInlineAllocator<32>> Found;
+	float MaxDistanceSquared = FMath::Square(MaxRadius);
+
+	Cells.HeapPush(FEntry(0.0f, 0), CloserFirst);
+	while (Cells.Num() > 0)
+	{
+		FEntry Top;
+		Cells.HeapPop(Top, CloserFirst, false);
+		if (Top.Key > MaxDistanceSquared)
+		{
+			break;
+		}
+
+		const FNode& Node = Nodes[Top.Value];
+		if (Node.IsLeaf())
+		{
+			for (int32 Item = Node.FirstItem; Item < Node.FirstItem + Node.NumItems; ++Item)
+			{
+				const float DistanceSquared = FVector3f::DistSquared(Center, SortedLocations[Item]);
+				if (DistanceSquared > MaxDistanceSquared || !IsSlotValid(SortedSlots[Item]))
+				{
+					continue;
+				}
+
+				Found.HeapPush(FEntry(DistanceSquared, SortedSlots[Item]), FartherFirst);
+				if (Found.Num() > Count)
+				{
+					FEntry Dropped;
+					Found.HeapPop(Dropped, FartherFirst, false);
+				}
+				if (Found.Num() == Count)
+				{
+					// Nothing farther than the farthest of the Count closest can enter anymore
+					MaxDistanceSquared = Found.HeapTop().Key;
+				}
+			}
+			continue;
+		}
+
+		for (int32 Child = Node.FirstChild; Child < Node.FirstChild + Node.NumChildren; ++Child)
+		{
+			const FNode& ChildNode = Nodes[Child];
+			const FVector3f Outside = ((Center - ChildNode.Center).GetAbs() - FVector3f(ChildNode.HalfSize)).ComponentMax(FVector3f::ZeroVector);
+			Cells.HeapPush(FEntry(Outside.SizeSquared(), Child), CloserFirst);
+		}
+	}
+
+	Found.Sort(CloserFirst);
+	for (const FEntry& Entry : Found)
+	{
+		OutSlots.Add(Entry.Value);
+	}
+}
+
+void FFlockOctree::CollectClusters(TArrayView<const FVector3f> Views, float MinDistance, float MaxAngle, TArray<int32>& OutNodes) const
+{
+	if (Nodes.Num() == 0 || Views.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+	while (Stack.Num() > 0)
+	{
+		const int32 NodeIndex = Stack.Pop(false);
+		const FNode& Node = Nodes[NodeIndex];
+		float Distance = TNumericLimits<float>::Max();
+		for (const FVector3f& View : Views)
+		{
+			Distance = FMath::Min(Distance, FVector3f::Dist(View, Node.Center));
+		}
+		Distance = FMath::Max(Distance - Node.HalfSize * FlockOctree::Sqrt3, 0.0f);
+
+		const bool bFar = Distance >= MinDistance;
+		if (bFar && (Node.IsLeaf() || 2.0f * Node.HalfSize <= MaxAngle * Distance))
+		{
+			OutNodes.Add(NodeIndex);
+			continue;
+		}
+
+		for (int32 Child = Node.FirstChild; Child < Node.FirstChild + Node.NumChildren; ++Child)
+		{
+			Stack.Add(Child);
+		}
+	}
+}
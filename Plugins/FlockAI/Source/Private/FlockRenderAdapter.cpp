@@ -0,0 +1,388 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockRenderAdapter.h"
+
+#include "FlockAI.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "GameFramework/Actor.h"
+
+namespace FlockRenderAdapter
+{
+	// Empty components of the chunked backend kept for the next cells the flock enters, the others are destroyed
+	constexpr int32 MaxPooledChunks = 16;
+
+	// Every component of the adapter keeps its instances packed, a removal moves the last instance into the hole
+	struct FChunk
+	{
+		UInstancedStaticMeshComponent* Component = nullptr;
+		FIntVector Cell = FIntVector::ZeroValue;
+		// Handle of every instance of the component
+		TArray<int32> Handles;
+		// World transform of every instance, the source of the batched updates
+		TArray<FTransform> Transforms;
+		int32 FirstDirty = MAX_int32;
+		int32 LastDirty = INDEX_NONE;
+		// Custom data floats of every instance, packed like the transforms
+		TArray<float> CustomData;
+		int32 FirstDirtyCustomData = MAX_int32;
+		int32 LastDirtyCustomData = INDEX_NONE;
+
+		void MarkDirty(int32 Instance)
+		{
+			FirstDirty = FMath::Min(FirstDirty, Instance);
+			LastDirty = FMath::Max(LastDirty, Instance);
+		}
+
+		void MarkCustomDataDirty(int32 Instance)
+		{
+			FirstDirtyCustomData = FMath::Min(FirstDirtyCustomData, Instance);
+			LastDirtyCustomData = FMath::Max(LastDirtyCustomData, Instance);
+		}
+	};
+
+	struct FInstanceLocation
+	{
+		int32 Chunk = INDEX_NONE;
+		int32 Instance = INDEX_NONE;
+	};
+
+	class FInstancedRenderAdapter : public IFlockRenderAdapter
+	{
+	public:
+		FInstancedRenderAdapter(EFlockRenderBackend InBackend, UInstancedStaticMeshComponent* InTemplate, float InChunkSize, int32 InNumCustomData)
+			: Backend(InBackend)
+			, Template(InTemplate)
+			, ChunkSize(FMath::Max(InChunkSize, 100.0f))
+			, NumCustomData(FMath::Max(InNumCustomData, 0))
+		{
+			check(Template);
+			// A plain instanced template already is the component the instanced backend would create
+			bDrawWithTemplate = Backend == EFlockRenderBackend::HierarchicalInstancedStaticMesh
+				|| (Backend == EFlockRenderBackend::InstancedStaticMesh && !Template->IsA<UHierarchicalInstancedStaticMeshComponent>());
+
+			// Meshes without custom data keep the one the template was set up with
+			if (bDrawWithTemplate && NumCustomData > 0)
+			{
+				Template->SetNumCustomDataFloats(NumCustomData);
+			}
+		}
+
+		virtual int32 AddInstance(const FTransform& WorldTransform) override
+		{
+			LLM_SCOPE_BYTAG(FlockAI_Rendering);
+			FInstanceLocation Location;
+			Location.Chunk = FindOrAddChunk(WorldTransform.GetLocation());
+			const int32 Handle = Instances.Add(Location);
+			Instances[Handle].Instance = AddToChunk(Location.Chunk, Handle, WorldTransform);
+			return Handle;
+		}
+
+		virtual void RemoveInstance(int32 Handle) override
+		{
+			if (!Instances.IsValidIndex(Handle))
+			{
+				return;
+			}
+
+			const FInstanceLocation Location = Instances[Handle];
+			Instances.RemoveAt(Handle);
+			RemoveFromChunk(Location.Chunk, Location.Instance);
+		}
+
+		virtual void SetInstanceTransform(int32 Handle, const FTransform& WorldTransform) override
+		{
+			FInstanceLocation& Location = Instances[Handle];
+			if (Backend == EFlockRenderBackend::ChunkedInstancedStaticMesh && GetCell(WorldTransform.GetLocation()) != Chunks[Location.Chunk].Cell)
+			{
+				// The instance crossed to another cell, move it and its custom data to the component of that cell
+				LLM_SCOPE_BYTAG(FlockAI_Rendering);
+				MovedCustomData.Reset();
+				MovedCustomData.Append(GetCustomData(Chunks[Location.Chunk], Location.Instance));
+				RemoveFromChunk(Location.Chunk, Location.Instance);
+				Location.Chunk = FindOrAddChunk(WorldTransform.GetLocation());
+				Location.Instance = AddToChunk(Location.Chunk, Handle, WorldTransform);
+				if (NumCustomData > 0)
+				{
+					SetInstanceCustomData(Handle, MovedCustomData);
+				}
+				return;
+			}
+
+			FChunk& Chunk = Chunks[Location.Chunk];
+			Chunk.Transforms[Location.Instance] = WorldTransform;
+			Chunk.MarkDirty(Location.Instance);
+		}
+
+		virtual void SetInstanceCustomData(int32 Handle, TArrayView<const float> CustomData) override
+		{
+			check(CustomData.Num() == NumCustomData);
+			const FInstanceLocation& Location = Instances[Handle];
+			FChunk& Chunk = Chunks[Location.Chunk];
+			FMemory::Memcpy(GetCustomData(Chunk, Location.Instance).GetData(), CustomData.GetData(), NumCustomData * sizeof(float));
+			Chunk.MarkCustomDataDirty(Location.Instance);
+		}
+
+		virtual void Flush() override
+		{
+			LLM_SCOPE_BYTAG(FlockAI_Rendering);
+			for (FChunk& Chunk : Chunks)
+			{
+				FlushCustomData(Chunk);
+				if (Chunk.LastDirty < Chunk.FirstDirty)
+				{
+					continue;
+				}
+
+				if (Chunk.FirstDirty == 0 && Chunk.LastDirty == Chunk.Transforms.Num() - 1)
+				{
+					Chunk.Component->BatchUpdateInstancesTransforms(0, Chunk.Transforms, true, true, false);
+				}
+				else
+				{
+					DirtyTransforms.Reset();
+					DirtyTransforms.Append(&Chunk.Transforms[Chunk.FirstDirty], Chunk.LastDirty - Chunk.FirstDirty + 1);
+					Chunk.Component->BatchUpdateInstancesTransforms(Chunk.FirstDirty, DirtyTransforms, true, true, false);
+				}
+
+				Chunk.FirstDirty = MAX_int32;
+				Chunk.LastDirty = INDEX_NONE;
+			}
+		}
+
+		virtual int32 Num() const override
+		{
+			return Instances.Num();
+		}
+
+		virtual int32 GetNumCustomData() const override
+		{
+			return NumCustomData;
+		}
+
+		virtual void Reserve(int32 NumInstances) override
+		{
+			LLM_SCOPE_BYTAG(FlockAI_Rendering);
+			Instances.Reserve(NumInstances);
+			if (Backend == EFlockRenderBackend::ChunkedInstancedStaticMesh)
+			{
+				// How the instances spread over the cells is not known yet
+				return;
+			}
+
+			FChunk& Chunk = Chunks[FindOrAddChunk(FVector::ZeroVector)];
+			const int32 NumAdded = NumInstances - Chunk.Transforms.Num();
+			if (NumAdded > 0)
+			{
+				Chunk.Handles.Reserve(NumInstances);
+				Chunk.Transforms.Reserve(NumInstances);
+				Chunk.CustomData.Reserve(NumInstances * NumCustomData);
+				Chunk.Component->PreAllocateInstancesMemory(NumAdded);
+			}
+		}
+
+		virtual SIZE_T GetAllocatedSize() const override
+		{
+			SIZE_T Size = Chunks.GetAllocatedSize() + ChunkByCell.GetAllocatedSize() + Instances.GetAllocatedSize()
+				+ DirtyTransforms.GetAllocatedSize() + MovedCustomData.GetAllocatedSize();
+			Size += FreeChunks.GetAllocatedSize();
+			for (const FChunk& Chunk : Chunks)
+			{
+				Size += Chunk.Handles.GetAllocatedSize() + Chunk.Transforms.GetAllocatedSize() + Chunk.CustomData.GetAllocatedSize();
+				if (IsValid(Chunk.Component))
+				{
+					Size += Chunk.Component->PerInstanceSMData.GetAllocatedSize() + Chunk.Component->PerInstanceSMCustomData.GetAllocatedSize();
+				}
+			}
+			return Size;
+		}
+
+		virtual void Release() override
+		{
+			for (FChunk& Chunk : Chunks)
+			{
+				if (Chunk.Component == Template)
+				{
+					Template->ClearInstances();
+				}
+				else if (IsValid(Chunk.Component))
+				{
+					Chunk.Component->DestroyComponent();
+				}
+			}
+			Chunks.Reset();
+			ChunkByCell.Reset();
+			FreeChunks.Reset();
+			Instances.Reset();
+		}
+
+	private:
+		TArrayView<float> GetCustomData(FChunk& Chunk, int32 Instance) const
+		{
+			return TArrayView<float>(Chunk.CustomData.GetData() + Instance * NumCustomData, NumCustomData);
+		}
+
+		void FlushCustomData(FChunk& Chunk) const
+		{
+			if (Chunk.LastDirtyCustomData < Chunk.FirstDirtyCustomData)
+			{
+				return;
+			}
+
+			// The component has no ranged custom data update. Its floats are packed like ours, so the dirty range is
+			// copied in one go and the render state is rebuilt once from them
+			check(Chunk.Component->NumCustomDataFloats == NumCustomData);
+			check(Chunk.Component->PerInstanceSMCustomData.Num() == Chunk.CustomData.Num());
+			const int32 FirstFloat = Chunk.FirstDirtyCustomData * NumCustomData;
+			const int32 NumFloats = (Chunk.LastDirtyCustomData - Chunk.FirstDirtyCustomData + 1) * NumCustomData;
+			FMemory::Memcpy(Chunk.Component->PerInstanceSMCustomData.GetData() + FirstFloat, Chunk.CustomData.GetData() + FirstFloat, NumFloats * sizeof(float));
+			Chunk.Component->MarkRenderStateDirty();
+
+			Chunk.FirstDirtyCustomData = MAX_int32;
+			Chunk.LastDirtyCustomData = INDEX_NONE;
+		}
+
+		FIntVector GetCell(const FVector& WorldLocation) const
+		{
+			return FIntVector(
+				FMath::FloorToInt(WorldLocation.X / ChunkSize),
+				FMath::FloorToInt(WorldLocation.Y / ChunkSize),
+				FMath::FloorToInt(WorldLocation.Z / ChunkSize));
+		}
+
+		int32 FindOrAddChunk(const FVector& WorldLocation)
+		{
+			const FIntVector Cell = Backend == EFlockRenderBackend::ChunkedInstancedStaticMesh ? GetCell(WorldLocation) : FIntVector::ZeroValue;
+			if (const int32* ChunkIndex = ChunkByCell.Find(Cell))
+			{
+				return *ChunkIndex;
+			}
+
+			if (FreeChunks.Num() > 0)
+			{
+				const int32 ChunkIndex = FreeChunks.Pop(false);
+				Chunks[ChunkIndex].Cell = Cell;
+				return ChunkByCell.Add(Cell, ChunkIndex);
+			}
+
+			FChunk Chunk;
+			Chunk.Cell = Cell;
+			Chunk.Component = bDrawWithTemplate ? Template : CreateComponent();
+			return ChunkByCell.Add(Cell, Chunks.Add(MoveTemp(Chunk)));
+		}
+
+		/* Give the component of a cell the flock left to the pool, or destroy it when the pool is full */
+		void ReleaseChunk(int32 ChunkIndex)
+		{
+			FChunk& Chunk = Chunks[ChunkIndex];
+			ChunkByCell.Remove(Chunk.Cell);
+			Chunk.FirstDirty = MAX_int32;
+			Chunk.LastDirty = INDEX_NONE;
+			Chunk.FirstDirtyCustomData = MAX_int32;
+			Chunk.LastDirtyCustomData = INDEX_NONE;
+			if (FreeChunks.Num() < MaxPooledChunks)
+			{
+				FreeChunks.Add(ChunkIndex);
+				return;
+			}
+
+			if (IsValid(Chunk.Component))
+			{
+				Chunk.Component->DestroyComponent();
+			}
+			Chunks.RemoveAt(ChunkIndex);
+		}
+
+		UInstancedStaticMeshComponent* CreateComponent() const
+		{
+			AActor* Owner = Template->GetOwner();
+			check(Owner);
+			UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(Owner, NAME_None, RF_Transient);
+			Component->SetMobility(EComponentMobility::Movable);
+			Component->SetStaticMesh(Template->GetStaticMesh());
+			Component->OverrideMaterials = Template->OverrideMaterials;
+			Component->CastShadow = Template->CastShadow;
+			if (NumCustomData > 0)
+			{
+				Component->SetNumCustomDataFloats(NumCustomData);
+			}
+			Component->SetCullDistances(Template->InstanceStartCullDistance, Template->InstanceEndCullDistance);
+			// The flock finds its neighbours in its own octree, the instances do not need bodies
+			Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+			Component->SetupAttachment(Owner->GetRootComponent());
+			Component->RegisterComponent();
+			Owner->AddInstanceComponent(Component);
+			return Component;
+		}
+
+		int32 AddToChunk(int32 ChunkIndex, int32 Handle, const FTransform& WorldTransform)
+		{
+			FChunk& Chunk = Chunks[ChunkIndex];
+			const int32 Instance = Chunk.Component->AddInstance(WorldTransform, true);
+			check(Instance == Chunk.Transforms.Num());
+			Chunk.Handles.Add(Handle);
+			Chunk.Transforms.Add(WorldTransform);
+			Chunk.CustomData.AddZeroed(NumCustomData);
+			return Instance;
+		}
+
+		void RemoveFromChunk(int32 ChunkIndex, int32 Instance)
+		{
+			// Remove the last instance of the component and move its transform into the hole, the component
+			// keeps the same indices whether it removes with a swap or by shifting
+			FChunk& Chunk = Chunks[ChunkIndex];
+			const int32 LastInstance = Chunk.Transforms.Num() - 1;
+			if (Instance != LastInstance)
+			{
+				const int32 MovedHandle = Chunk.Handles[LastInstance];
+				Chunk.Handles[Instance] = MovedHandle;
+				Chunk.Transforms[Instance] = Chunk.Transforms[LastInstance];
+				Instances[MovedHandle].Instance = Instance;
+				Chunk.MarkDirty(Instance);
+				if (NumCustomData > 0)
+				{
+					FMemory::Memcpy(GetCustomData(Chunk, Instance).GetData(), GetCustomData(Chunk, LastInstance).GetData(), NumCustomData * sizeof(float));
+					Chunk.MarkCustomDataDirty(Instance);
+				}
+			}
+
+			Chunk.Handles.Pop(false);
+			Chunk.Transforms.Pop(false);
+			Chunk.CustomData.SetNum(LastInstance * NumCustomData, false);
+			Chunk.Component->RemoveInstance(LastInstance);
+			if (Chunk.LastDirty >= LastInstance)
+			{
+				Chunk.LastDirty = LastInstance - 1;
+			}
+			if (Chunk.LastDirtyCustomData >= LastInstance)
+			{
+				Chunk.LastDirtyCustomData = LastInstance - 1;
+			}
+
+			if (LastInstance == 0 && Backend == EFlockRenderBackend::ChunkedInstancedStaticMesh)
+			{
+				ReleaseChunk(ChunkIndex);
+			}
+		}
+
+		EFlockRenderBackend Backend;
+		UInstancedStaticMeshComponent* Template;
+		// The single chunk draws with the template instead of a component created by the adapter
+		bool bDrawWithTemplate = false;
+		float ChunkSize;
+		int32 NumCustomData;
+		// Sparse so the indices kept by the instances survive the release of other chunks
+		TSparseArray<FChunk> Chunks;
+		TMap<FIntVector, int32> ChunkByCell;
+		// Empty chunks of the pool, they are in Chunks but not in ChunkByCell
+		TArray<int32> FreeChunks;
+		TSparseArray<FInstanceLocation> Instances;
+		TArray<FTransform> DirtyTransforms;
+		TArray<float> MovedCustomData;
+	};
+}
+
+TUniquePtr<IFlockRenderAdapter> IFlockRenderAdapter::Create(EFlockRenderBackend Backend, UInstancedStaticMeshComponent* Template, float ChunkSize,
+															 int32 NumCustomData)
+{
+	return MakeUnique<FlockRenderAdapter::FInstancedRenderAdapter>(Backend, Template, ChunkSize, NumCustomData);
+}
@@ -0,0 +1,109 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockReplication.h"
+
+#include "Agent.h"
+
+void FFlockReplicatedBoid::Pack(const FVector& WorldLocation, const FVector3f& InHeading, double Time)
+{
+	using namespace FlockReplication;
+
+	PackTime = Time;
+	auto PackAxis = [](double Coordinate, int16& OutCell, uint16& OutOffset)
+	{
+		const double Cell = FMath::Clamp(FMath::FloorToDouble(Coordinate / CellSize), static_cast<double>(MIN_int16), static_cast<double>(MAX_int16));
+		const double Alpha = FMath::Clamp((Coordinate - Cell * CellSize) / CellSize, 0.0, 1.0);
+		OutCell = static_cast<int16>(Cell);
+		OutOffset = static_cast<uint16>(FMath::RoundToInt32(Alpha * OffsetMax));
+	};
+	PackAxis(WorldLocation.X, CellX, OffsetX);
+	PackAxis(WorldLocation.Y, CellY, OffsetY);
+	PackAxis(WorldLocation.Z, CellZ, OffsetZ);
+
+	const FVector3f Direction = InHeading.GetSafeNormal();
+	const float Yaw = FMath::Atan2(Direction.Y, Direction.X);
+	const float Pitch = FMath::Asin(FMath::Clamp(Direction.Z, -1.0f, 1.0f));
+	const uint32 PackedYaw = static_cast<uint32>(FMath::RoundToInt32(Yaw / (2.0f * PI) * YawCodes)) & (YawCodes - 1);
+	const uint32 PackedPitch = static_cast<uint32>(FMath::Clamp(FMath::RoundToInt32((Pitch + HALF_PI) / PI * PitchSteps), 0, static_cast<int32>(PitchSteps)));
+	Heading = static_cast<uint16>(PackedYaw | (PackedPitch << YawBits));
+}
+
+FVector FFlockReplicatedBoid::GetWorldLocation() const
+{
+	using namespace FlockReplication;
+
+	auto UnpackAxis = [](int16 Cell, uint16 Offset)
+	{
+		return (Cell + static_cast<double>(Offset) / OffsetMax) * CellSize;
+	};
+	return FVector(UnpackAxis(CellX, OffsetX), UnpackAxis(CellY, OffsetY), UnpackAxis(CellZ, OffsetZ));
+}
+
+FVector FFlockReplicatedBoid::GetPredictedLocation(double Time, float Speed) const
+{
+	// Same dead reckoning as UBoid::UpdateProxy, the latency of the clients is not known here
+	return GetWorldLocation() + FVector(GetHeading()) * Speed * FMath::Max(Time - PackTime, 0.0);
+}
+
+FVector3f FFlockReplicatedBoid::GetHeading() const
+{
+	using namespace FlockReplication;
+
+	const uint32 PackedYaw = Heading & (YawCodes - 1);
+	const uint32 PackedPitch = FMath::Min<uint32>(Heading >> YawBits, PitchSteps);
+	const float Yaw = static_cast<float>(PackedYaw) / YawCodes * 2.0f * PI;
+	const float Pitch = static_cast<float>(PackedPitch) / PitchSteps * PI - HALF_PI;
+	return FVector3f(FMath::Cos(Pitch) * FMath::Cos(Yaw), FMath::Cos(Pitch) * FMath::Sin(Yaw), FMath::Sin(Pitch));
+}
+
+bool FFlockReplicatedBoid::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	using namespace FlockReplication;
+
+	Ar.SerializeIntPacked(BoidId);
+	Ar << ProfileIndex;
+	Ar << CellX;
+	Ar << CellY;
+	Ar << CellZ;
+
+	// The three 12 bit offsets share 36 bits
+	uint64 PackedOffsets = static_cast<uint64>(OffsetX)
+		| (static_cast<uint64>(OffsetY) << OffsetBits)
+		| (static_cast<uint64>(OffsetZ) << (2 * OffsetBits));
+	Ar.SerializeBits(&PackedOffsets, 3 * OffsetBits);
+	if (Ar.IsLoading())
+	{
+		OffsetX = static_cast<uint16>(PackedOffsets & OffsetMax);
+		OffsetY = static_cast<uint16>((PackedOffsets >> OffsetBits) & OffsetMax);
+		OffsetZ = static_cast<uint16>((PackedOffsets >> (2 * OffsetBits)) & OffsetMax);
+	}
+
+	Ar << Heading;
+
+	bOutSuccess = true;
+	return true;
+}
+
+void FFlockReplicatedBoid::PreReplicatedRemove(const FFlockReplicatedFlock& InArraySerializer)
+{
+	if (IsValid(InArraySerializer.Agent))
+	{
+		InArraySerializer.Agent->OnReplicatedBoidRemoved(*this);
+	}
+}
+
+void FFlockReplicatedBoid::PostReplicatedAdd(const FFlockReplicatedFlock& InArraySerializer)
+{
+	if (IsValid(InArraySerializer.Agent))
+	{
+		InArraySerializer.Agent->OnReplicatedBoidAdded(*this);
+	}
+}
+
+void FFlockReplicatedBoid::PostReplicatedChange(const FFlockReplicatedFlock& InArraySerializer)
+{
+	if (IsValid(InArraySerializer.Agent))
+	{
+		InArraySerializer.Agent->OnReplicatedBoidChanged(*this);
+	}
+}
@@ -0,0 +1,129 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockStatistics.h"
+
+#include "Async/ParallelFor.h"
+
+void FFlockStatistics::Build(TArrayView<const FVector3f> Locations, TArrayView<const FVector3f> Headings, const FBox3f& LocalBounds, const FVector& Origin,
+							 int32 Resolution, FFlockStatisticsScratch& Scratch)
+{
+	using namespace FlockStatistics;
+
+	check(Locations.Num() == Headings.Num());
+
+	if (Locations.Num() == 0 || !LocalBounds.IsValid)
+	{
+		Reset();
+		return;
+	}
+
+	NumBoids = Locations.Num();
+	DensityResolution = FMath::Clamp(Resolution, 1, MaxDensityResolution);
+	const int32 NumCells = DensityResolution * DensityResolution;
+	Density.Init(0, NumCells);
+
+	// Every block sums into its own slot and histogram, merged below in block order so the result does not depend on the threads
+	const int32 NumBlocks = FMath::DivideAndRoundUp(NumBoids, BlockSize);
+	Scratch.Blocks.SetNumUninitialized(NumBlocks, false);
+	Scratch.BlockDensity.SetNumUninitialized(NumBlocks * NumCells, false);
+	ParallelFor(NumBlocks, [this, Locations, Headings, &LocalBounds, &Scratch, NumCells](int32 BlockIndex)
+	{
+		FFlockStatisticsScratch::FBlock& Block = Scratch.Blocks[BlockIndex];
+		Block = FFlockStatisticsScratch::FBlock();
+		int32* Cells = &Scratch.BlockDensity[BlockIndex * NumCells];
+		FMemory::Memzero(Cells, NumCells * sizeof(int32));
+
+		const int32 End = FMath::Min((BlockIndex + 1) * BlockSize, NumBoids);
+		for (int32 Index = BlockIndex * BlockSize; Index < End; ++Index)
+		{
+			Block.LocationSum += FVector(Locations[Index]);
+			if (!Headings[Index].IsZero())
+			{
+				Block.HeadingSum += Headings[Index];
+				++Block.NumHeadings;
+			}
+			++Cells[GetDensityCell(Locations[Index], LocalBounds)];
+		}
+	}, NumBlocks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	FVector LocationSum = FVector::ZeroVector;
+	FVector3f HeadingSum = FVector3f::ZeroVector;
+	int32 NumHeadings = 0;
+	for (int32 BlockIndex = 0; BlockIndex < NumBlocks; ++BlockIndex)
+	{
+		LocationSum += Scratch.Blocks[BlockIndex].LocationSum;
+		HeadingSum += Scratch.Blocks[BlockIndex].HeadingSum;
+		NumHeadings += Scratch.Blocks[BlockIndex].NumHeadings;
+		const int32* Cells = &Scratch.BlockDensity[BlockIndex * NumCells];
+		for (int32 Cell = 0; Cell < NumCells; ++Cell)
+		{
+			Density[Cell] += Cells[Cell];
+		}
+	}
+
+	const FVector LocalCentroid = LocationSum / NumBoids;
+	Centroid = Origin + LocalCentroid;
+	Bounds = FBox(Origin + FVector(LocalBounds.Min), Origin + FVector(LocalBounds.Max));
+
+	// Headings are unit, the length of their mean tells how aligned the flock is. The boids standing still have a zero
+	// heading, they would read as spread
+	const FVector3f MeanHeading = NumHeadings > 0 ? HeadingSum / static_cast<float>(NumHeadings) : FVector3f::ForwardVector;
+	Heading = FVector(MeanHeading.GetSafeNormal(UE_KINDA_SMALL_NUMBER, FVector3f::ForwardVector));
+	HeadingSpread = FMath::Clamp(1.0f - MeanHeading.Size(), 0.0f, 1.0f);
+
+	int32 HotspotCell = 0;
+	for (int32 Cell = 1; Cell < NumCells; ++Cell)
+	{
+		if (Density[Cell] > Density[HotspotCell])
+		{
+			HotspotCell = Cell;
+		}
+	}
+	HotspotCount = Density[HotspotCell];
+
+	const FVector2D CellSize = FVector2D(Bounds.GetSize()) / DensityResolution;
+	HotspotLocation = FVector(
+		Bounds.Min.X + (HotspotCell % DensityResolution + 0.5) * CellSize.X,
+		Bounds.Min.Y + (HotspotCell / DensityResolution + 0.5) * CellSize.Y,
+		Centroid.Z);
+}
+
+void FFlockStatistics::Reset()
+{
+	NumBoids = 0;
+	Centroid = FVector::ZeroVector;
+	Bounds = FBox(ForceInit);
+	Heading = FVector::ForwardVector;
+	HeadingSpread = 0.0f;
+	Density.Reset();
+	DensityResolution = 0;
+	HotspotLocation = FVector::ZeroVector;
+	HotspotCount = 0;
+}
+
+int32 FFlockStatistics::GetDensityAt(const FVector& WorldLocation) const
+{
+	if (NumBoids == 0 || WorldLocation.X < Bounds.Min.X || WorldLocation.Y < Bounds.Min.Y
+		|| WorldLocation.X > Bounds.Max.X || WorldLocation.Y > Bounds.Max.Y)
+	{
+		return 0;
+	}
+
+	const FVector Size = Bounds.GetSize();
+	const int32 X = Size.X > 0.0 ? FMath::Min(FMath::FloorToInt32((WorldLocation.X - Bounds.Min.X) / Size.X * DensityResolution), DensityResolution - 1) : 0;
+	const int32 Y = Size.Y > 0.0 ? FMath::Min(FMath::FloorToInt32((WorldLocation.Y - Bounds.Min.Y) / Size.Y * DensityResolution), DensityResolution - 1) : 0;
+	return Density[Y * DensityResolution + X];
+}
+
+SIZE_T FFlockStatistics::GetAllocatedSize() const
+{
+	return Density.GetAllocatedSize();
+}
+
+int32 FFlockStatistics::GetDensityCell(const FVector3f& LocalLocation, const FBox3f& LocalBounds) const
+{
+	const FVector3f Size = LocalBounds.GetSize().ComponentMax(FVector3f(UE_KINDA_SMALL_NUMBER));
+	const int32 X = FMath::Clamp(FMath::FloorToInt32((LocalLocation.X - LocalBounds.Min.X) / Size.X * DensityResolution), 0, DensityResolution - 1);
+	const int32 Y = FMath::Clamp(FMath::FloorToInt32((LocalLocation.Y - LocalBounds.Min.Y) / Size.Y * DensityResolution), 0, DensityResolution - 1);
+	return Y * DensityResolution + X;
+}
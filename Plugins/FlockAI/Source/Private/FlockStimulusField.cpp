@@ -0,0 +1,438 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockStimulusField.h"
+
+#include "Stimulus.h"
+#include "Async/ParallelFor.h"
+
+namespace FlockStimulusField
+{
+	// Stimuli closer than this to their recorded location are considered still
+	constexpr double MoveTolerance = 1.0;
+
+	// Cells around the cell of a stimulus where the boids evaluate it exactly, in full up to 1 and fading at 2
+	constexpr int32 NearCells = 2;
+
+	// Push of a negative stimulus at Location, the same kernel as the boids with the distance clamped at 1
+	FVector3f GetNegativeForce(const FVector& Location, const FVector& StimulusLocation, float Value, float PhysicalRadius)
+	{
+		const FVector3f Direction(StimulusLocation - Location);
+		const float Distance = Direction.Size();
+		return Direction.GetSafeNormal(UE_KINDA_SMALL_NUMBER) / FMath::Max(FMath::Abs(Distance - PhysicalRadius), 1.0f) * Value;
+	}
+
+	// True if the grid point leaves the stimulus of the cell to the exact evaluation: it is a corner of a cell
+	// within one cell of the stimulus
+	bool IsNearPoint(const FIntVector& Cell, const FIntVector& Point)
+	{
+		return Point.X >= Cell.X - 1 && Point.X <= Cell.X + 2
+			&& Point.Y >= Cell.Y - 1 && Point.Y <= Cell.Y + 2
+			&& Point.Z >= Cell.Z - 1 && Point.Z <= Cell.Z + 2;
+	}
+
+	// Trilinear weight of the corners that leave the stimulus to the exact evaluation, along one axis
+	float GetExactWeight(int32 CellOffset, float Alpha)
+	{
+		switch (CellOffset)
+		{
+		case -2: return 1.0f - Alpha;
+		case -1:
+		case 0:
+		case 1: return 1.0f;
+		case 2: return Alpha;
+		default: return 0.0f;
+		}
+	}
+}
+
+void FFlockStimulusField::Reset()
+{
+	Points.Reset();
+	ConsumableStimuli.Reset();
+	NearStimuli.Reset();
+	States.Reset();
+	StrongestPositive = nullptr;
+	StrongestPositiveValue = 0.0f;
+	NumPoints = FIntVector::ZeroValue;
+	Bounds = FBox(ForceInit);
+}
+
+void FFlockStimulusField::Update(TArrayView<AStimulus* const> InStimuli, const FBox& FlockBounds, float InCellSize, float PhysicalRadius, float ConsumeRadius)
+{
+	if (!IsBuilt() || PhysicalRadius != SplatPhysicalRadius || ConsumeRadius != SplatConsumeRadius || !Bounds.IsInside(FlockBounds))
+	{
+		Build(InStimuli, FlockBounds, InCellSize, PhysicalRadius, ConsumeRadius);
+		return;
+	}
+
+	// Same order as the boids: a positive stimulus only counts if it is stronger than the previous ones
+	TMap<AStimulus*, bool, TInlineSetAllocator<16>> Records;
+	float PositiveMaxValue = 0.0f;
+	AStimulus* Strongest = nullptr;
+	for (AStimulus* Stimulus : InStimuli)
+	{
+		if (!IsValid(Stimulus))
+		{
+			continue;
+		}
+
+		if (!Bounds.IsInside(Stimulus->GetActorLocation()))
+		{
+			Build(InStimuli, FlockBounds, InCellSize, PhysicalRadius, ConsumeRadius);
+			return;
+		}
+
+		const bool bRecord = Stimulus->Value > PositiveMaxValue;
+		if (bRecord)
+		{
+			PositiveMaxValue = Stimulus->Value;
+			Strongest = Stimulus;
+		}
+		Records.Add(Stimulus, bRecord);
+	}
+
+	// Take out the stimuli that are gone or changed, they are splatted again with their new state
+	TArray<AStimulus*, TInlineAllocator<16>> Changed;
+	for (const TPair<AStimulus*, FStimulusState>& Pair : States)
+	{
+		AStimulus* Stimulus = Pair.Key;
+		const bool* bRecord = Records.Find(Stimulus);
+		if (bRecord == nullptr || *bRecord != Pair.Value.bRecord || Stimulus->Value != Pair.Value.Value || Stimulus->Radius != Pair.Value.Radius
+			|| !Stimulus->GetActorLocation().Equals(Pair.Value.Location, FlockStimulusField::MoveTolerance))
+		{
+			Changed.Add(Stimulus);
+		}
+	}
+
+	for (AStimulus* Stimulus : Changed)
+	{
+		FStimulusState State;
+		States.RemoveAndCopyValue(Stimulus, State);
+		LinkCells(Stimulus, State, false);
+		Splat(State, -1.0f);
+	}
+
+	for (const TPair<AStimulus*, bool>& Record : Records)
+	{
+		if (States.Contains(Record.Key))
+		{
+			continue;
+		}
+
+		FStimulusState& State = States.Add(Record.Key);
+		State.Location = Record.Key->GetActorLocation();
+		State.Value = Record.Key->Value;
+		State.Radius = Record.Key->Radius;
+		State.Cell = GetCell(State.Location);
+		State.bRecord = Record.Value;
+		LinkCells(Record.Key, State, true);
+		Splat(State, 1.0f);
+	}
+
+	StrongestPositive = Strongest;
+	StrongestPositiveValue = PositiveMaxValue;
+	if (States.Num() == 0)
+	{
+		Reset();
+	}
+}
+
+void FFlockStimulusField::Build(TArrayView<AStimulus* const> InStimuli, const FBox& FlockBounds, float InCellSize, float PhysicalRadius, float ConsumeRadius)
+{
+	check(InCellSize > 0.0f);
+	Reset();
+
+	Bounds = FlockBounds;
+	SplatPhysicalRadius = PhysicalRadius;
+	SplatConsumeRadius = ConsumeRadius;
+	TArray<AStimulus*, TInlineAllocator<16>> Splatted;
+	for (AStimulus* Stimulus : InStimuli)
+	{
+		if (!IsValid(Stimulus))
+		{
+			continue;
+		}
+
+		FStimulusState& State = States.Add(Stimulus);
+		State.Location = Stimulus->GetActorLocation();
+		State.Value = Stimulus->Value;
+		State.Radius = Stimulus->Radius;
+		Bounds += State.Location;
+
+		// Same order as the boids: a positive stimulus only counts if it is stronger than the previous ones
+		if (State.Value > StrongestPositiveValue)
+		{
+			StrongestPositiveValue = State.Value;
+			StrongestPositive = Stimulus;
+			State.bRecord = true;
+		}
+		Splatted.Add(Stimulus);
+	}
+
+	if (Splatted.Num() == 0 || !Bounds.IsValid)
+	{
+		Reset();
+		return;
+	}
+
+	// Room for the flock to move before the next rebuild
+	Bounds = Bounds.ExpandBy(Bounds.GetExtent().GetMax() * 0.25 + InCellSize);
+	CellSize = FMath::Max(static_cast<double>(InCellSize), Bounds.GetSize().GetMax() / (MaxPointsPerAxis - 1));
+	NumPoints = FIntVector(
+		FMath::CeilToInt32(Bounds.GetSize().X / CellSize) + 1,
+		FMath::CeilToInt32(Bounds.GetSize().Y / CellSize) + 1,
+		FMath::CeilToInt32(Bounds.GetSize().Z / CellSize) + 1);
+	Origin = Bounds.Min;
+	Points.SetNum(NumPoints.X * NumPoints.Y * NumPoints.Z);
+
+	TArray<const FStimulusState*, TInlineAllocator<16>> SplatStates;
+	for (AStimulus* Stimulus : Splatted)
+	{
+		FStimulusState& State = States.FindChecked(Stimulus);
+		State.Cell = GetCell(State.Location);
+		LinkCells(Stimulus, State, true);
+		SplatStates.Add(&State);
+	}
+
+	ParallelFor(Points.Num(), [this, &SplatStates](int32 Index)
+	{
+		const FIntVector PointCoords(Index % NumPoints.X, (Index / NumPoints.X) % NumPoints.Y, Index / (NumPoints.X * NumPoints.Y));
+		for (const FStimulusState* State : SplatStates)
+		{
+			AddToPoint(*State, PointCoords, 1.0f, Points[Index]);
+		}
+	});
+}
+
+void FFlockStimulusField::AddToPoint(const FStimulusState& State, const FIntVector& PointCoords, float Sign, FFlockStimulusSample& Point) const
+{
+	if (FlockStimulusField::IsNearPoint(State.Cell, PointCoords))
+	{
+		return;
+	}
+
+	const FVector Location = Origin + FVector(PointCoords) * CellSize;
+	if (State.Value < 0.0f)
+	{
+		const FVector3f Force = FlockStimulusField::GetNegativeForce(Location, State.Location, State.Value, SplatPhysicalRadius);
+		Point.NegativeSum += Force * Sign;
+		if (Sign > 0.0f)
+		{
+			Point.NegativeMaxFactor = FMath::Max(Point.NegativeMaxFactor, Force.Size());
+		}
+		else if (Force.Size() >= Point.NegativeMaxFactor * (1.0f - UE_KINDA_SMALL_NUMBER))
+		{
+			// The strongest push went out with the stimulus, find the next one among the stimuli left
+			Point.NegativeMaxFactor = 0.0f;
+			for (const TPair<AStimulus*, FStimulusState>& Other : States)
+			{
+				if (Other.Value.Value < 0.0f && !FlockStimulusField::IsNearPoint(Other.Value.Cell, PointCoords))
+				{
+					Point.NegativeMaxFactor = FMath::Max(Point.NegativeMaxFactor,
+						FlockStimulusField::GetNegativeForce(Location, Other.Value.Location, Other.Value.Value, SplatPhysicalRadius).Size());
+				}
+			}
+		}
+	}
+	else if (State.bRecord)
+	{
+		Point.PositiveSum += State.Value * FVector3f(State.Location - Location).GetSafeNormal(UE_KINDA_SMALL_NUMBER) * Sign;
+	}
+}
+
+void FFlockStimulusField::Splat(const FStimulusState& State, float Sign)
+{
+	// Only the negative stimuli and the strongest positive ones have a far contribution
+	if (State.Value >= 0.0f && !State.bRecord)
+	{
+		return;
+	}
+
+	ParallelFor(Points.Num(), [this, &State, Sign](int32 Index)
+	{
+		const FIntVector PointCoords(Index % NumPoints.X, (Index / NumPoints.X) % NumPoints.Y, Index / (NumPoints.X * NumPoints.Y));
+		AddToPoint(State, PointCoords, Sign, Points[Index]);
+	});
+}
+
+void FFlockStimulusField::LinkCells(AStimulus* Stimulus, const FStimulusState& State, bool bLink)
+{
+	const FIntVector NumCells = NumPoints - FIntVector(1);
+	auto LinkCell = [Stimulus, bLink](TMap<int32, TArray<AStimulus*, TInlineAllocator<2>>>& Cells, int32 Cell)
+	{
+		if (bLink)
+		{
+			Cells.FindOrAdd(Cell).Add(Stimulus);
+			return;
+		}
+
+		TArray<AStimulus*, TInlineAllocator<2>>& CellStimuli = Cells.FindChecked(Cell);
+		CellStimuli.RemoveSingleSwap(Stimulus, false);
+		if (CellStimuli.Num() == 0)
+		{
+			Cells.Remove(Cell);
+		}
+	};
+
+	using FlockStimulusField::NearCells;
+	for (int32 Z = FMath::Max(State.Cell.Z - NearCells, 0); Z <= FMath::Min(State.Cell.Z + NearCells, NumCells.Z - 1); ++Z)
+	{
+		for (int32 Y = FMath::Max(State.Cell.Y - NearCells, 0); Y <= FMath::Min(State.Cell.Y + NearCells, NumCells.Y - 1); ++Y)
+		{
+			for (int32 X = FMath::Max(State.Cell.X - NearCells, 0); X <= FMath::Min(State.Cell.X + NearCells, NumCells.X - 1); ++X)
+			{
+				LinkCell(NearStimuli, X + NumCells.X * (Y + NumCells.Y * Z));
+			}
+		}
+	}
+
+	// Every cell touched by the consume sphere of a positive stimulus lists it
+	if (State.Value < 0.0f)
+	{
+		return;
+	}
+
+	const FVector Reach(State.Radius + SplatConsumeRadius);
+	const FVector Min = (State.Location - Reach - Origin) / CellSize;
+	const FVector Max = (State.Location + Reach - Origin) / CellSize;
+	for (int32 Z = FMath::Max(FMath::FloorToInt32(Min.Z), 0); Z <= FMath::Min(FMath::FloorToInt32(Max.Z), NumCells.Z - 1); ++Z)
+	{
+		for (int32 Y = FMath::Max(FMath::FloorToInt32(Min.Y), 0); Y <= FMath::Min(FMath::FloorToInt32(Max.Y), NumCells.Y - 1); ++Y)
+		{
+			for (int32 X = FMath::Max(FMath::FloorToInt32(Min.X), 0); X <= FMath::Min(FMath::FloorToInt32(Max.X), NumCells.X - 1); ++X)
+			{
+				LinkCell(ConsumableStimuli, X + NumCells.X * (Y + NumCells.Y * Z));
+			}
+		}
+	}
+}
+
+int32 FFlockStimulusField::GetCellIndex(const FVector& WorldLocation) const
+{
+	const FVector Local = (WorldLocation - Origin) / CellSize;
+	const FIntVector NumCells = NumPoints - FIntVector(1);
+	const int32 X = FMath::FloorToInt32(Local.X);
+	const int32 Y = FMath::FloorToInt32(Local.Y);
+	const int32 Z = FMath::FloorToInt32(Local.Z);
+	if (X < 0 || Y < 0 || Z < 0 || X >= NumCells.X || Y >= NumCells.Y || Z >= NumCells.Z)
+	{
+		return INDEX_NONE;
+	}
+	return X + NumCells.X * (Y + NumCells.Y * Z);
+}
+
+FIntVector FFlockStimulusField::GetCell(const FVector& WorldLocation) const
+{
+	const FVector Local = (WorldLocation - Origin) / CellSize;
+	const FIntVector NumCells = NumPoints - FIntVector(1);
+	return FIntVector(
+		FMath::Clamp(FMath::FloorToInt32(Local.X), 0, NumCells.X - 1),
+		FMath::Clamp(FMath::FloorToInt32(Local.Y), 0, NumCells.Y - 1),
+		FMath::Clamp(FMath::FloorToInt32(Local.Z), 0, NumCells.Z - 1));
+}
+
+bool FFlockStimulusField::Sample(const FVector& WorldLocation, float PhysicalRadius, const TSet<AStimulus*>& SkippedStimuli, FFlockStimulusSample& OutSample) const
+{
+	using namespace FlockStimulusField;
+
+	const int32 Cell = IsBuilt() ? GetCellIndex(WorldLocation) : INDEX_NONE;
+	if (Cell == INDEX_NONE)
+	{
+		return false;
+	}
+
+	const FVector Local = (WorldLocation - Origin) / CellSize;
+	const FIntVector CellCoords(FMath::FloorToInt32(Local.X), FMath::FloorToInt32(Local.Y), FMath::FloorToInt32(Local.Z));
+	const FVector3f Alpha(Local - FVector(CellCoords));
+
+	OutSample = FFlockStimulusSample();
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const int32 DX = Corner & 1;
+		const int32 DY = (Corner >> 1) & 1;
+		const int32 DZ = (Corner >> 2) & 1;
+		const float Weight = (DX ? Alpha.X : 1.0f - Alpha.X) * (DY ? Alpha.Y : 1.0f - Alpha.Y) * (DZ ? Alpha.Z : 1.0f - Alpha.Z);
+		const FFlockStimulusSample& Point = Points[(CellCoords.X + DX) + NumPoints.X * ((CellCoords.Y + DY) + NumPoints.Y * (CellCoords.Z + DZ))];
+		OutSample.NegativeSum += Point.NegativeSum * Weight;
+		OutSample.NegativeMaxFactor += Point.NegativeMaxFactor * Weight;
+		OutSample.PositiveSum += Point.PositiveSum * Weight;
+	}
+	OutSample.PositiveMaxFactor = StrongestPositiveValue;
+
+	// The corners left the near stimuli out, they take the rest of the weight at the location of the boid
+	const TArray<AStimulus*, TInlineAllocator<2>>* CellStimuli = NearStimuli.Find(Cell);
+	if (CellStimuli == nullptr)
+	{
+		return true;
+	}
+
+	for (AStimulus* Stimulus : *CellStimuli)
+	{
+		const FStimulusState& State = States.FindChecked(Stimulus);
+		if (SkippedStimuli.Contains(Stimulus) || (State.Value >= 0.0f && !State.bRecord))
+		{
+			continue;
+		}
+
+		const FIntVector Offset = State.Cell - CellCoords;
+		const float Weight = GetExactWeight(Offset.X, Alpha.X) * GetExactWeight(Offset.Y, Alpha.Y) * GetExactWeight(Offset.Z, Alpha.Z);
+		if (State.Value < 0.0f)
+		{
+			const FVector3f Force = GetNegativeForce(WorldLocation, State.Location, State.Value, PhysicalRadius) * Weight;
+			OutSample.NegativeSum += Force;
+			OutSample.NegativeMaxFactor = FMath::Max(OutSample.NegativeMaxFactor, Force.Size());
+		}
+		else
+		{
+			OutSample.PositiveSum += State.Value * Weight * FVector3f(State.Location - WorldLocation).GetSafeNormal(UE_KINDA_SMALL_NUMBER);
+		}
+	}
+	return true;
+}
+
+bool FFlockStimulusField::IsAdjacent(const AStimulus* Stimulus, const FVector& WorldLocation) const
+{
+	const FStimulusState* State = States.Find(Stimulus);
+	if (State == nullptr || GetCellIndex(WorldLocation) == INDEX_NONE)
+	{
+		return false;
+	}
+
+	const FIntVector Offset = State->Cell - GetCell(WorldLocation);
+	return FMath::Abs(Offset.X) <= 1 && FMath::Abs(Offset.Y) <= 1 && FMath::Abs(Offset.Z) <= 1;
+}
+
+void FFlockStimulusField::GetConsumableStimuli(const FVector& WorldLocation, TArray<AStimulus*, TInlineAllocator<4>>& OutStimuli) const
+{
+	const int32 Cell = GetCellIndex(WorldLocation);
+	if (const TArray<AStimulus*, TInlineAllocator<2>>* CellStimuli = Cell != INDEX_NONE ? ConsumableStimuli.Find(Cell) : nullptr)
+	{
+		OutStimuli.Append(*CellStimuli);
+	}
+}
+
+bool FFlockStimulusField::GetStrongestPositive(FVector& OutLocation) const
+{
+	const FStimulusState* State = StrongestPositive != nullptr ? States.Find(StrongestPositive) : nullptr;
+	if (State == nullptr)
+	{
+		return false;
+	}
+
+	OutLocation = State->Location;
+	return true;
+}
+
+SIZE_T FFlockStimulusField::GetAllocatedSize() const
+{
+	SIZE_T Size = Points.GetAllocatedSize() + ConsumableStimuli.GetAllocatedSize() + NearStimuli.GetAllocatedSize() + States.GetAllocatedSize();
+	for (const TPair<int32, TArray<AStimulus*, TInlineAllocator<2>>>& Cell : ConsumableStimuli)
+	{
+		Size += Cell.Value.GetAllocatedSize();
+	}
+	for (const TPair<int32, TArray<AStimulus*, TInlineAllocator<2>>>& Cell : NearStimuli)
+	{
+		Size += Cell.Value.GetAllocatedSize();
+	}
+	return Size;
+}
@@ -0,0 +1,61 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockBenchmarkCommandlet.h"
+#include "Dom/JsonObject.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/*
+ * A short run of the FlockBenchmark commandlet over small flocks with and without stimuli, collision and floor
+ * following. Every scenario must end with its boids and non-zero timings, run it headless with
+ * UnrealEditor-Cmd FlockAIGame -ExecCmds="Automation RunTests FlockAI; Quit" -nullrhi -unattended
+ */
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockBenchmarkTest, "FlockAI.Benchmark.Scenarios",
+								 EAutomationTestFlags::EditorContext | EAutomationTestFlags::CommandletContext | EAutomationTestFlags::ProductFilter)
+
+bool FFlockBenchmarkTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumBoids = 256;
+	constexpr int32 Frames = 8;
+	const FString Output = FPaths::ProjectIntermediateDir() / TEXT("FlockAI") / TEXT("BenchmarkTest");
+	const FString Params = FString::Printf(
+		TEXT("-Sizes=%d -Spacings=150 -Stimuli=0,4 -Collision=0,1 -FollowFloor=0,1 -Pipelines=1 -Frames=%d -Warmup=2 -DeltaSeconds=0.016667 -Output=\"%s\""),
+		NumBoids, Frames, *Output);
+
+	UFlockBenchmarkCommandlet* Commandlet = NewObject<UFlockBenchmarkCommandlet>();
+	TestEqual(TEXT("The benchmark succeeds"), Commandlet->Main(Params), 0);
+
+	FString Json;
+	if (!TestTrue(TEXT("The benchmark writes its JSON"), FFileHelper::LoadFileToString(Json, *(Output + TEXT(".json")))))
+	{
+		return false;
+	}
+
+	TSharedPtr<FJsonObject> Root;
+	if (!TestTrue(TEXT("The JSON parses"), FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Json), Root) && Root.IsValid()))
+	{
+		return false;
+	}
+
+	const TArray<TSharedPtr<FJsonValue>>& Results = Root->GetArrayField(TEXT("Results"));
+	TestEqual(TEXT("Every scenario has a result"), Results.Num(), 8);
+	for (const TSharedPtr<FJsonValue>& Value : Results)
+	{
+		const TSharedPtr<FJsonObject>& Result = Value->AsObject();
+		const FString Scenario = Result->GetStringField(TEXT("Scenario"));
+		TestEqual(FString::Printf(TEXT("%s measures every frame"), *Scenario), static_cast<int32>(Result->GetNumberField(TEXT("Frames"))), Frames);
+		TestTrue(FString::Printf(TEXT("%s keeps its boids"), *Scenario), Result->GetNumberField(TEXT("FinalBoids")) > 0.0);
+		TestTrue(FString::Printf(TEXT("%s ticks the frames"), *Scenario), Result->GetNumberField(TEXT("FrameMs")) > 0.0);
+		TestTrue(FString::Printf(TEXT("%s ticks the agent"), *Scenario), Result->GetNumberField(TEXT("AgentMs")) > 0.0);
+		TestTrue(FString::Printf(TEXT("%s steers the boids"), *Scenario), Result->GetNumberField(TEXT("SteeringMs")) > 0.0);
+		TestTrue(FString::Printf(TEXT("%s reports its memory"), *Scenario), Result->GetNumberField(TEXT("BytesPerBoid")) > 0.0);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,60 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockReplication.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace FlockReplicationTest
+{
+	// Seconds a boid is dead reckoned for, well past the time between two updates of a replicated Agent
+	constexpr double ReckoningTime = 10.0;
+
+	// Default BaseMovementSpeed of the boids
+	constexpr float Speed = 150.0f;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockReplicationHeadingTest, "FlockAI.Replication.HeadingQuantization",
+								 EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FFlockReplicationHeadingTest::RunTest(const FString& Parameters)
+{
+	using namespace FlockReplicationTest;
+
+	const FVector Location(12345.6, -7890.1, 250.0);
+	for (int32 Step = 0; Step < 16; ++Step)
+	{
+		// Level headings all around, -PI and PI included
+		const float Yaw = -PI + Step * (2.0f * PI / 16);
+		const FVector3f Heading(FMath::Cos(Yaw), FMath::Sin(Yaw), 0.0f);
+
+		FFlockReplicatedBoid Item;
+		Item.Pack(Location, Heading, 0.0);
+		const FVector3f RoundTrip = Item.GetHeading();
+		TestTrue(FString::Printf(TEXT("Level heading %s stays level (%s)"), *Heading.ToString(), *RoundTrip.ToString()),
+				 FMath::Abs(RoundTrip.Z) <= UE_KINDA_SMALL_NUMBER);
+		TestTrue(FString::Printf(TEXT("Heading %s round trips (%s)"), *Heading.ToString(), *RoundTrip.ToString()),
+				 FVector3f::DotProduct(RoundTrip, Heading) >= FMath::Cos(PI / FlockReplication::YawCodes));
+
+		// A boid flying straight and level stays within the distance threshold of its prediction
+		const FVector Predicted = Item.GetPredictedLocation(ReckoningTime, Speed);
+		const FVector Actual = Item.GetWorldLocation() + FVector(Heading) * Speed * ReckoningTime;
+		TestTrue(FString::Printf(TEXT("Level boid is predicted at its height after %.0f s (%.2f cm)"), ReckoningTime, Predicted.Z - Actual.Z),
+				 FMath::Abs(Predicted.Z - Actual.Z) <= 1.0);
+	}
+
+	// Both ends of the yaw range are the same heading and the same code
+	FFlockReplicatedBoid Negative;
+	FFlockReplicatedBoid Positive;
+	Negative.Pack(Location, FVector3f(-1.0f, -UE_SMALL_NUMBER, 0.0f), 0.0);
+	Positive.Pack(Location, FVector3f(-1.0f, UE_SMALL_NUMBER, 0.0f), 0.0);
+	TestEqual(TEXT("-PI and PI share a yaw code"), Negative.Heading, Positive.Heading);
+
+	// The poles are kept too
+	FFlockReplicatedBoid Up;
+	Up.Pack(Location, FVector3f::UpVector, 0.0);
+	TestTrue(TEXT("Straight up round trips"), Up.GetHeading().Z >= 1.0f - UE_KINDA_SMALL_NUMBER);
+	return true;
+}
+
+#endif
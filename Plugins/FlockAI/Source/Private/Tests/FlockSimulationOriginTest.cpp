@@ -0,0 +1,114 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "Agent.h"
+#include "Boid.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace FlockSimulationOriginTest
+{
+	// Far from the world origin, where float32 world coordinates would be off by centimetres
+	const FVector FarOrigins[] = {
+		FVector::ZeroVector,
+		FVector(1.0e7, -3.0e6, 2.0e5),
+		FVector(-1.0e9, 5.0e8, -2.5e4)};
+
+	// A float32 coordinate of magnitude M is rounded by M * 2^-24 at most on every axis, FLT_EPSILON covers the three axes
+	double GetErrorBound(double Magnitude)
+	{
+		return FMath::Max(Magnitude, 1.0) * FLT_EPSILON;
+	}
+
+	TArray<FVector> GetOffsets(float Distance)
+	{
+		TArray<FVector> Offsets = {
+			FVector(Distance, 0.0, 0.0), FVector(0.0, -Distance, 0.0), FVector(0.0, 0.0, Distance),
+			FVector(1.0, 1.0, 1.0).GetSafeNormal() * Distance, FVector(-1.0, 0.5, -0.25).GetSafeNormal() * Distance};
+		FRandomStream Random(7);
+		for (int32 Index = 0; Index < 32; ++Index)
+		{
+			Offsets.Add(Random.GetUnitVector() * Random.FRandRange(0.0f, Distance));
+		}
+		return Offsets;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlockSimulationOriginTest, "FlockAI.Simulation.OriginPrecision",
+								 EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FFlockSimulationOriginTest::RunTest(const FString& Parameters)
+{
+	using namespace FlockSimulationOriginTest;
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("FlockSimulationOriginTest"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+	AAgent* Agent = World->SpawnActor<AAgent>();
+	check(Agent);
+	const float RebaseDistance = Agent->RebaseDistance;
+
+	for (const FVector& Origin : FarOrigins)
+	{
+		Agent->SimulationOrigin = Origin;
+
+		// World to local and back, up to the distance at which the origin is rebased
+		double MaxError = 0.0;
+		for (const FVector& Offset : GetOffsets(RebaseDistance))
+		{
+			const FVector WorldLocation = Origin + Offset;
+			const FVector RoundTrip = Agent->ToWorld(Agent->ToLocal(WorldLocation));
+			const double Error = FVector::Dist(RoundTrip, WorldLocation);
+			MaxError = FMath::Max(MaxError, Error);
+			TestTrue(FString::Printf(TEXT("Round trip of %s is within %.4f cm (%.4f cm)"), *WorldLocation.ToString(), GetErrorBound(Offset.Size()), Error),
+					 Error <= GetErrorBound(Offset.Size()));
+		}
+		AddInfo(FString::Printf(TEXT("Origin %s: largest round trip error %.5f cm at %.0f cm"), *Origin.ToString(), MaxError, RebaseDistance));
+
+		// Only the local space keeps that precision far from the world origin
+		if (Origin.Size() >= 1.0e7)
+		{
+			// Fractions of a centimetre, whole centimetres up to 2^24 are exact in float32
+			const FVector WorldLocation = Origin + FVector(RebaseDistance * 0.37 + 0.3, 0.3, 0.3);
+			TestTrue(TEXT("Float32 world coordinates lose more than the local space"),
+					 FVector::Dist(FVector(FVector3f(WorldLocation)), WorldLocation) > GetErrorBound(RebaseDistance));
+		}
+
+		// A rebase moves the origin and the local locations of the boids, not the boids
+		const TArray<FVector> Offsets = GetOffsets(RebaseDistance);
+		TArray<FVector> WorldLocations;
+		for (const FVector& Offset : Offsets)
+		{
+			UBoid* Boid = NewObject<UBoid>(Agent);
+			Boid->Init(Agent->ToLocal(Origin + Offset), FRotator::ZeroRotator, INDEX_NONE);
+			Boid->RenderedLocation = Boid->LocalLocation;
+			Boid->NetLocation = Boid->LocalLocation;
+			Boid->NeighbourListLocation = Boid->LocalLocation;
+			Boid->FlockSlot = Agent->Boids.Add(Boid);
+			WorldLocations.Add(Agent->ToWorld(Boid->LocalLocation));
+		}
+
+		const FVector3f NewLocalOrigin(RebaseDistance, -0.5f * RebaseDistance, 0.25f * RebaseDistance);
+		Agent->RebaseSimulationOrigin(NewLocalOrigin);
+		TestTrue(TEXT("The origin moves by the rebase offset"), Agent->SimulationOrigin.Equals(Origin + FVector(NewLocalOrigin), UE_KINDA_SMALL_NUMBER));
+
+		for (int32 Index = 0; Index < Offsets.Num(); ++Index)
+		{
+			const UBoid* Boid = Agent->Boids[Index];
+			const double Bound = GetErrorBound(Offsets[Index].Size() + FVector(NewLocalOrigin).Size());
+			TestTrue(TEXT("Rebase keeps the simulated location"), FVector::Dist(Agent->ToWorld(Boid->LocalLocation), WorldLocations[Index]) <= Bound);
+			TestTrue(TEXT("Rebase keeps the rendered location"), FVector::Dist(Agent->ToWorld(Boid->RenderedLocation), WorldLocations[Index]) <= Bound);
+			TestTrue(TEXT("Rebase keeps the network location"), FVector::Dist(Agent->ToWorld(Boid->NetLocation), WorldLocations[Index]) <= Bound);
+			TestTrue(TEXT("Rebase keeps the neighbour list location"), FVector::Dist(Agent->ToWorld(Boid->NeighbourListLocation), WorldLocations[Index]) <= Bound);
+		}
+		Agent->Boids.Reset();
+	}
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	return true;
+}
+
+#endif
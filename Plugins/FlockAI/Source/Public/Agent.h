@@ -3,29 +3,209 @@
 #pragma once
 
 #include "GameFramework/Actor.h"
+#include "Containers/Queue.h"
+#include "ConvexVolume.h"
+#include "FlockHibernation.h"
+#include "FlockOctree.h"
+#include "FlockProfile.h"
+#include "FlockRenderAdapter.h"
+#include "FlockReplication.h"
+#include "FlockSpatialQuery.h"
+#include "FlockStatistics.h"
+#include "FlockStimulusField.h"
+#include "Boid.h"
 #include "Agent.generated.h"
 
 class AStimulus;
-class UBoid;
+class UFlockBehaviourModule;
+class UFlockDistanceField;
+class UFlockFlowField;
+
+/* Time spent by the last update of an Agent in every stage, in milliseconds */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockStageTimings
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float OctreeMs = 0.0f;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float NeighbourhoodMs = 0.0f;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float SteeringMs = 0.0f;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float InstanceUploadMs = 0.0f;
+
+	/* Draining the command queue: the queued spawns, removals and stimulus changes */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float CommandsMs = 0.0f;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float TotalMs = 0.0f;
+};
+
+enum class EFlockCommandType : uint8
+{
+	SpawnBoid,
+	RemoveBoid,
+	AddGlobalStimulus,
+	RemoveGlobalStimulus
+};
+
+/* A change to the flock queued from any thread, applied by the Agent at the start of its tick */
+struct FFlockCommand
+{
+	EFlockCommandType Type = EFlockCommandType::SpawnBoid;
+	FVector Location = FVector::ZeroVector;
+	FRotator Rotation = FRotator::ZeroRotator;
+	uint8 ProfileIndex = 0;
+
+	// The boid or the stimulus, weak as the queue is not seen by the garbage collector
+	TWeakObjectPtr<UObject> Object;
+};
+
+/* Pair sums of one task of the symmetric pair pass, kept between updates and zeroed again by the merge */
+struct FFlockPairSumsContext
+{
+	TArray<FFlockNeighbourSums> Sums;
+
+	// Slots written since the last merge, the only entries that are not zero
+	TArray<int32> Touched;
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return Sums.GetAllocatedSize() + Touched.GetAllocatedSize();
+	}
+};
+
+/* Memory held by an Agent on the game thread, in bytes. The render thread and GPU copies of the instances are not counted */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockMemoryStats
+{
+	GENERATED_BODY()
+
+	/* The boid objects, the arrays they own, the settings overrides and the hibernated flocks */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 BoidBytes = 0;
+
+	/* Octree, packed locations and headings, stimulus grid, behaviour force streams and statistics */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 SpatialBytes = 0;
+
+	/* Instance transforms and custom data of the render adapter and its mesh components */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 RenderBytes = 0;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 ReplicationBytes = 0;
+
+	/* Distance field and flow field with its cached goals, shared by the whole flock whatever its size */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 NavigationBytes = 0;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int64 TotalBytes = 0;
+
+	/* TotalBytes over the boids, for capacity planning */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float BytesPerBoid = 0.0f;
+};
+
+/* Vectors of the boids drawn by the debug view of an Agent */
+UENUM(meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
+enum class EFlockDebugComponents : uint8
+{
+	None = 0 UMETA(Hidden),
+	Velocity = 1 << 0,
+	Alignment = 1 << 1,
+	Cohesion = 1 << 2,
+	Separation = 1 << 3,
+	Stimuli = 1 << 4,
+	Collision = 1 << 5,
+	Behaviour = 1 << 6,
+	Floor = 1 << 7
+};
+ENUM_CLASS_FLAGS(EFlockDebugComponents)
+
+/*
+ * Debug view of a flock: the boids whose settings enable bEnableDebugDraw are sampled and their vectors sent to the
+ * line batcher of the world in a single batch, so the cost is bounded by MaxBoids whatever the size of the flock
+ */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockDebugDrawSettings
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Debug", meta = (Bitmask, BitmaskEnum = "/Script/FlockAI.EFlockDebugComponents"))
+	int32 Components = static_cast<int32>(EFlockDebugComponents::Velocity | EFlockDebugComponents::Alignment
+		| EFlockDebugComponents::Cohesion | EFlockDebugComponents::Separation | EFlockDebugComponents::Collision);
+
+	/* Draw every Nth boid of the flock */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Debug", meta = (ClampMin = 1))
+	int32 Stride = 1;
+
+	/* Boids drawn per frame at most */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Debug", meta = (ClampMin = 1))
+	int32 MaxBoids = 256;
+
+	/*
+	 * When not zero only the boids around the focus are drawn: the point under the cursor of the first player, or
+	 * the point it looks at when the cursor is hidden
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Debug", meta = (ClampMin = 0.0f))
+	float FocusRadius = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Debug", meta = (ClampMin = 0.0f))
+	float Thickness = 1.0f;
+};
 
 UCLASS()
 class FLOCKAI_API AAgent : public AActor
 {
 	GENERATED_BODY()
 
-	/* The instanced mesh component */
+	friend class FFlockSimulationOriginTest;
+
+	/* The instanced mesh component, it draws the boids with the hierarchical backend and is the template of the others */
 	UPROPERTY(Category = Mesh, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	class UHierarchicalInstancedStaticMeshComponent* HierarchicalInstancedStaticMeshComponent;
 
+	/* Draws one impostor per distant cluster of boids, set its mesh and material like the boid mesh */
+	UPROPERTY(Category = Mesh, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	class UInstancedStaticMeshComponent* ImpostorMeshComponent;
+
 public:
 	AAgent();
 
+	/* Spawn, remove and the global stimulus changes can be called from any thread, they are applied at the start of the next tick */
 	UFUNCTION(BlueprintCallable, Category = "AI")
-	void SpawnBoid(const FVector& Location, const FRotator& Rotation);
+	void SpawnBoid(const FVector& Location, const FRotator& Rotation, uint8 ProfileIndex = 0);
 
 	UFUNCTION(BlueprintCallable, Category = "AI")
 	void RemoveBoid(UBoid* Boid);
 
+	/*
+	 * Boids inside a sphere, cone or box, or the nearest ones, answered from the octree of the last update so the
+	 * boids are where they were at its start. Safe to call from any thread while the Agent is not ticking
+	 */
+	UFUNCTION(BlueprintCallable, Category = "AI|Query")
+	void QueryBoids(const FFlockSpatialQuery& Query, TArray<FFlockBoidHandle>& OutBoids) const;
+
+	/* Run many queries in one call, in parallel for large batches. OutResults matches Queries */
+	UFUNCTION(BlueprintCallable, Category = "AI|Query")
+	void QueryBoidsBatch(const TArray<FFlockSpatialQuery>& Queries, TArray<FFlockSpatialQueryResult>& OutResults) const;
+
+	/* The boid of a handle, null once it is removed */
+	UFUNCTION(BlueprintPure, Category = "AI|Query")
+	UBoid* ResolveBoid(FFlockBoidHandle Handle) const;
+
+	/* Size the flock, octree, replication and instance storage for NumBoids boids before spawning them */
+	UFUNCTION(BlueprintCallable, Category = "AI")
+	void ReserveBoids(int32 NumBoids);
+
 	UFUNCTION(BlueprintCallable, Category = "AI")
 	void AddGlobalStimulus(AStimulus* Stimulus);
 
@@ -35,34 +215,490 @@ public:
 	UFUNCTION(BlueprintCallable, BlueprintPure = false, Category = "AI")
 	const TArray<AStimulus*>& GetGlobalStimulus() const { return GlobalStimuli; }
 
+	/* Add a behaviour evaluated over the whole flock every tick, the Agent becomes its outer */
+	UFUNCTION(BlueprintCallable, Category = "AI|Behaviour")
+	void AddBehaviourModule(UFlockBehaviourModule* Module);
+
+	UFUNCTION(BlueprintCallable, Category = "AI|Behaviour")
+	void RemoveBehaviourModule(UFlockBehaviourModule* Module);
+
+	/* Tuning of a boid: its override if any, else its profile, else DefaultSettings */
+	const FFlockBoidSettings& GetBoidSettings(const UBoid* Boid) const;
+
+	/* Give a single boid its own tuning, stored in a sparse side table */
+	UFUNCTION(BlueprintCallable, Category = "AI")
+	void SetBoidSettingsOverride(UBoid* Boid, const FFlockBoidSettings& Settings);
+
+	UFUNCTION(BlueprintCallable, Category = "AI")
+	void ClearBoidSettingsOverride(UBoid* Boid);
+
+	/* The boids simulate in float32 relative to this origin, it follows the flock when it drifts further than RebaseDistance */
+	const FVector& GetSimulationOrigin() const { return SimulationOrigin; }
+	FVector ToWorld(const FVector3f& LocalLocation) const { return SimulationOrigin + FVector(LocalLocation); }
+	FVector3f ToLocal(const FVector& WorldLocation) const { return FVector3f(WorldLocation - SimulationOrigin); }
+
+	/* Octree of the boids built at the start of the update, used for the far-field aggregates */
+	const FFlockOctree& GetFlockOctree() const { return FlockOctree; }
+
+	/* Grid of the global stimuli, not built when bUseStimulusField is disabled or there are no global stimuli */
+	const FFlockStimulusField& GetStimulusField() const { return StimulusField; }
+
+	UFUNCTION(BlueprintPure, Category = "AI|Stats")
+	const FFlockStageTimings& GetStageTimings() const { return StageTimings; }
+
+	UFUNCTION(BlueprintPure, Category = "AI|Stats")
+	int32 GetNumBoids() const { return Boids.Num(); }
+
+	/* Centroid, bounds, heading and density of the flock at the start of the last update, no boid is visited */
+	UFUNCTION(BlueprintPure, Category = "AI|Stats")
+	const FFlockStatistics& GetStatistics() const { return Statistics; }
+
+	/* Impostor instances drawn for the distant clusters */
+	UFUNCTION(BlueprintPure, Category = "AI|Stats")
+	int32 GetNumImpostors() const { return ImpostorHandles.Num(); }
+
+	/* Walks every boid, meant for stats and capacity planning rather than every frame */
+	UFUNCTION(BlueprintCallable, Category = "AI|Stats")
+	FFlockMemoryStats GetMemoryStats() const;
+
+	/* Boids waiting in the hibernated flocks */
+	UFUNCTION(BlueprintPure, Category = "AI|Stats")
+	int32 GetNumHibernatedBoids() const;
+
+	/*
+	 * Bake the static geometry around the Agent into DistanceField. In the editor the field is saved as an asset under
+	 * /Game/FlockAI/Baked, at runtime it is a transient object of the Agent
+	 */
+	UFUNCTION(CallInEditor, BlueprintCallable, Category = "AI|Collision")
+	void BakeDistanceField();
+
+	const UFlockDistanceField* GetDistanceField() const { return DistanceField; }
+
+	/* Trace the ground around the Agent into FlowField, an asset in the editor and a transient object at runtime */
+	UFUNCTION(CallInEditor, BlueprintCallable, Category = "AI|Navigation")
+	void BakeFlowField();
+
+	UFlockFlowField* GetFlowField() const { return FlowField; }
+
+	/* Trace again the ground of the flow field inside Region after the terrain changed there, called for every level streamed in */
+	UFUNCTION(BlueprintCallable, Category = "AI|Navigation")
+	void UpdateFlowFieldRegion(const FBox& Region);
+
+	/* True when the Agent keeps the flock state without drawing it (dedicated servers) */
+	bool IsHeadless() const;
+
+	/* True on the clients of a replicated Agent, their boids are proxies of the server boids */
+	bool IsReplicatedProxy() const;
+
+	// Trace the flow field again under a streamed in level
+	void OnLevelAddedToWorld(ULevel* Level, UWorld* World);
+
+	// Called by the replicated flock on the clients
+	void OnReplicatedBoidAdded(const FFlockReplicatedBoid& Item);
+	void OnReplicatedBoidChanged(const FFlockReplicatedBoid& Item);
+	void OnReplicatedBoidRemoved(const FFlockReplicatedBoid& Item);
+
 	// Begin Actor Interface
+	virtual void PreRegisterAllComponents() override;
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	virtual void Tick(float DeltaSeconds) override;
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
 	// End Actor Interface
 
 public:
+	/* How the boids are drawn, it can only be changed before the first boid is spawned */
+	UPROPERTY(Category = Mesh, EditAnywhere, BlueprintReadWrite)
+	EFlockRenderBackend RenderBackend = EFlockRenderBackend::HierarchicalInstancedStaticMesh;
+
+	/* On dedicated servers the mesh component is never registered and no instance is created, the flock only lives in the simulation */
+	UPROPERTY(Category = Mesh, EditAnywhere, BlueprintReadWrite)
+	bool bHeadlessOnDedicatedServer = true;
+
+	/* Size of the cells of the chunked render backend */
+	UPROPERTY(Category = Mesh, EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 100.0f, EditCondition = "RenderBackend == EFlockRenderBackend::ChunkedInstancedStaticMesh"))
+	float RenderChunkSize = 5000.0f;
+
+	/*
+	 * Write the animation state of every boid into the custom data of its instance, for vertex animation materials:
+	 * 0 is the phase in [0, 1), 1 the speed in cm/s and 2 the yaw rate in radians/s. It can only be changed before
+	 * the first boid is spawned
+	 */
+	UPROPERTY(Category = Mesh, EditAnywhere, BlueprintReadWrite)
+	bool bWriteAnimationCustomData = false;
+
 	// The class of the Boid to spawn
 	UPROPERTY(Category = Spawn, EditDefaultsOnly)
 	TSubclassOf<UBoid> BoidBP;
 
+	/* Shared tuning of the flocks spawned by this Agent, boids reference them by index so they can be retuned live */
+	UPROPERTY(Category = "AI|Profile", EditAnywhere, BlueprintReadWrite)
+	TArray<UFlockProfile*> Profiles;
+
+	/* Tuning of the boids whose profile index is not in Profiles */
+	UPROPERTY(Category = "AI|Profile", EditAnywhere, BlueprintReadWrite)
+	FFlockBoidSettings DefaultSettings;
+
+	/*
+	 * Distance between the simulation origin and the centre of the flock that moves the origin to the flock.
+	 * A float32 location under 1.3 km keeps a precision better than 0.01 cm, far below the size of a boid.
+	 */
+	UPROPERTY(Category = "AI", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1000.0f, ClampMax = 1000000.0f))
+	float RebaseDistance = 100000.0f;
+
+	/*
+	 * Evaluate alignment, cohesion and separation once per pair of neighbours and accumulate them into both boids, in parallel.
+	 * Every boid then sees the flock as it was at the start of the tick. When disabled every boid gathers its own
+	 * Neighbourhood right before its update. Off by default as UBoid::Neighbourhood stays empty when it is enabled
+	 */
+	UPROPERTY(Category = "AI", EditAnywhere, BlueprintReadWrite)
+	bool bUseSymmetricPairForces = false;
+
+	/*
+	 * Run the update compiled for the stages enabled by every profile, resolved once per profile and tick. When disabled
+	 * the boids run the generic update that checks every stage at runtime
+	 */
+	UPROPERTY(Category = "AI", EditAnywhere, BlueprintReadWrite)
+	bool bUseSpecialisedPipelines = true;
+
+	/*
+	 * Boids outside the view of every local player run a cheap update (no traces, no far field, no stimulus overlaps)
+	 * and their instances are not updated until they are back in view. Every boid is simulated fully without local
+	 * players, and on a listen server replicating the flock while remote players are connected since their views are
+	 * not known and they receive the simulated state
+	 */
+	UPROPERTY(Category = "AI|Visibility", EditAnywhere, BlueprintReadWrite)
+	bool bCheapOffscreenSimulation = true;
+
+	/* Distance added to the physical radius of the boids when testing them against the views, so they are snapped before entering */
+	UPROPERTY(Category = "AI|Visibility", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bCheapOffscreenSimulation"))
+	float VisibilityMargin = 500.0f;
+
+	/*
+	 * Splat the global stimuli in a coarse grid sampled once by every boid, instead of every boid visiting every global
+	 * stimulus, the stimuli next to a boid are still evaluated exactly. Changed stimuli are splatted in and out of the
+	 * grid, it is rebuilt when the flock leaves it. Private stimuli are still visited
+	 */
+	UPROPERTY(Category = "AI|Stimuli", EditAnywhere, BlueprintReadWrite)
+	bool bUseStimulusField = true;
+
+	/* Smallest cell of the stimulus grid, it grows for large areas to keep the grid coarse */
+	UPROPERTY(Category = "AI|Stimuli", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 50.0f, EditCondition = "bUseStimulusField"))
+	float StimulusFieldCellSize = 500.0f;
+
+	/* Reduce the flock statistics every update, read them with GetStatistics */
+	UPROPERTY(Category = "AI|Stats", EditAnywhere, BlueprintReadWrite)
+	bool bUpdateStatistics = true;
+
+	/* Cells per axis of the density histogram of the statistics */
+	UPROPERTY(Category = "AI|Stats", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1, ClampMax = 64, EditCondition = "bUpdateStatistics"))
+	int32 StatisticsDensityResolution = 16;
+
+	/*
+	 * Past ImpostorDistance from every player the boids of a cluster are drawn by a single impostor instance at the
+	 * centroid of the cluster, oriented by its mean heading. The clusters are cells of the flock octree
+	 */
+	UPROPERTY(Category = "AI|Impostors", EditAnywhere, BlueprintReadWrite)
+	bool bUseImpostors = false;
+
+	UPROPERTY(Category = "AI|Impostors", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bUseImpostors"))
+	float ImpostorDistance = 20000.0f;
+
+	/*
+	 * Over this distance before ImpostorDistance the impostor grows in over the boids, custom data 0 of the impostor
+	 * goes from 0 to 1 for a dithered fade and 1 is the number of boids of the cluster
+	 */
+	UPROPERTY(Category = "AI|Impostors", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bUseImpostors"))
+	float ImpostorBlendDistance = 5000.0f;
+
+	/* Largest size of a cluster over its distance to the view, smaller values make more and smaller impostors */
+	UPROPERTY(Category = "AI|Impostors", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.01f, ClampMax = 2.0f, EditCondition = "bUseImpostors"))
+	float ImpostorMaxCellAngle = 0.15f;
+
+	/* Scale of the impostor of a single boid, it grows with the cube root of the boids in the cluster */
+	UPROPERTY(Category = "AI|Impostors", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bUseImpostors"))
+	float ImpostorScale = 1.0f;
+
+	/* Sampling and vectors of the debug view, drawn for the boids whose settings enable bEnableDebugDraw */
+	UPROPERTY(Category = "AI|Debug", EditAnywhere, BlueprintReadWrite)
+	FFlockDebugDrawSettings DebugDraw;
+
+	/* Extra steering behaviours (wander, containment...) evaluated over the packed flock and added to the move vector of every boid */
+	UPROPERTY(Category = "AI|Behaviour", EditAnywhere, Instanced, BlueprintReadOnly)
+	TArray<UFlockBehaviourModule*> BehaviourModules;
+
+	/* A boid is sent again when it is further than this from where the clients extrapolate it */
+	UPROPERTY(Category = "AI|Replication", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f))
+	float ReplicationDistanceThreshold = 25.0f;
+
+	/* A boid is sent again when its heading has turned more than this (degrees) from the replicated one */
+	UPROPERTY(Category = "AI|Replication", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1.0f, ClampMax = 180.0f))
+	float ReplicationHeadingThreshold = 10.0f;
+
+	/* Boids sent per net update at most, the ones closest to a player and with the largest error go first */
+	UPROPERTY(Category = "AI|Replication", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1))
+	int32 MaxReplicatedBoidsPerUpdate = 256;
+
+	/* How fast the client proxies catch up with the extrapolated server location */
+	UPROPERTY(Category = "AI|Replication", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.1f))
+	float ProxySmoothingSpeed = 8.0f;
+
+	/*
+	 * In World Partition levels the boids hibernate when the cells they are in are not activated: the boids are
+	 * replaced by a compact summary and spawned again once the cells stream back in. The flock is split in clusters of
+	 * HibernationCellSize that hibernate and rehydrate on their own. The Agent itself is not spatially loaded so it
+	 * can keep the summaries
+	 */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite)
+	bool bHibernateInUnloadedRegions = true;
+
+	/* Seconds between two checks of the streaming state of the flock */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bHibernateInUnloadedRegions"))
+	float HibernationCheckInterval = 1.0f;
+
+	/* Side of the clusters that hibernate together, about the size of the World Partition cells */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 100.0f, EditCondition = "bHibernateInUnloadedRegions"))
+	float HibernationCellSize = 25600.0f;
+
+	/* Seconds a cluster stays in unloaded cells before it hibernates, so boids crossing a border do not hibernate */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bHibernateInUnloadedRegions"))
+	float HibernationDelay = 3.0f;
+
+	/* A hibernated cluster comes back once the cells this far around it are activated too, more than it needs to stay */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.0f, EditCondition = "bHibernateInUnloadedRegions"))
+	float HibernationMargin = 2000.0f;
+
+	/* Boids spawned per frame when a hibernated flock is rehydrated */
+	UPROPERTY(Category = "AI|Hibernation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1, EditCondition = "bHibernateInUnloadedRegions"))
+	int32 RehydratedBoidsPerFrame = 128;
+
+	/* Baked distance field of the static geometry, when valid the boids sample it instead of sweeping for obstacles */
+	UPROPERTY(Category = "AI|Collision", EditAnywhere, BlueprintReadWrite)
+	UFlockDistanceField* DistanceField;
+
+	/* Bake the distance field at BeginPlay when there is no baked one */
+	UPROPERTY(Category = "AI|Collision", EditAnywhere, BlueprintReadWrite)
+	bool bBakeDistanceFieldOnBeginPlay = false;
+
+	/* Half size of the volume around the Agent covered by the distance field */
+	UPROPERTY(Category = "AI|Collision", EditAnywhere, BlueprintReadWrite)
+	FVector DistanceFieldExtent = FVector(5000.0, 5000.0, 1000.0);
+
+	UPROPERTY(Category = "AI|Collision", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 10.0f))
+	float DistanceFieldVoxelSize = 50.0f;
+
+	/* Distances are clamped to this value, it should cover the CollisionDistanceLook of the boids */
+	UPROPERTY(Category = "AI|Collision", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 10.0f))
+	float DistanceFieldMaxDistance = 400.0f;
+
+	/*
+	 * Terrain flow field, when valid the boids follow it toward the positive stimuli instead of going in a straight line.
+	 * At BeginPlay a baked asset is replaced by a transient copy owned by the Agent, that keeps the goals of its flock
+	 */
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite)
+	UFlockFlowField* FlowField;
+
+	/* Bake the flow field at BeginPlay when there is no baked one */
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite)
+	bool bBakeFlowFieldOnBeginPlay = false;
+
+	/* Half size of the area around the Agent covered by the flow field, Z bounds the ground traces */
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite)
+	FVector FlowFieldExtent = FVector(10000.0, 10000.0, 5000.0);
+
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 25.0f))
+	float FlowFieldCellSize = 200.0f;
+
+	/* Ground steeper than this blocks the boids */
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1.0f, ClampMax = 89.0f))
+	float FlowFieldMaxSlopeAngle = 40.0f;
+
+	/* Cells of the goal sweeps settled per tick, bounds the cost of a new goal */
+	UPROPERTY(Category = "AI|Navigation", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1))
+	int32 FlowFieldCellsPerTick = 16384;
+
 protected:
 	UFUNCTION(BlueprintCallable, Category = "AI")
 	void UpdateBoidNeighbourhood(UBoid* Boid);
 
+	/* BoidId is given by the server on the clients, otherwise the next identifier is used */
+	UBoid* CreateBoid(const FVector& Location, const FRotator& Rotation, uint8 ProfileIndex, int32 BoidId = INDEX_NONE);
+
+	/* One query of QueryBoids, Slots is scratch */
+	void RunQuery(const FFlockSpatialQuery& Query, TArray<int32>& Slots, TArray<FFlockBoidHandle>& OutBoids) const;
+
 	void UpdateBoids(float DeltaTime);
 
+	/* Clients: move the proxies toward the replicated state */
+	void UpdateProxyBoids(float DeltaTime);
+
+	/* Server: quantize the boids that moved enough into the replicated flock, by priority */
+	void UpdateReplicatedFlock();
+
+	bool ShouldReplicateFlock() const;
+
+	void BuildFlockOctree();
+
+	/* Rebuild the stimulus grid if the global stimuli changed or the flock left it */
+	void UpdateStimulusField();
+
+	/* Create the render adapter of the flock, unless it exists or the Agent is headless */
+	void CreateRenderAdapter();
+
+	/* Player view locations, the distances of the impostors and the replication priorities are measured from them */
+	void GetViewLocations(TArray<FVector, TInlineAllocator<8>>& OutLocations) const;
+
+	/* Draw the distant clusters with impostors and swap the instances of the boids that crossed ImpostorDistance */
+	void UpdateImpostors();
+
+	/* Buffer the transform and the animation custom data of the instance of the boid */
+	void SetBoidInstance(const UBoid* Boid);
+
+#if UE_ENABLE_DEBUG_DRAWING
+	/* Send the vectors of the sampled boids to the line batcher in one batch */
+	void DrawFlockDebug() const;
+
+	/* Point the debug view samples around, false without a local player */
+	bool GetDebugFocus(FVector& OutLocation) const;
+#endif
+
+	/* Gather the frustums of the local players for this tick */
+	void UpdateViewFrustums();
+
+	/* A boid is visible if it or its rendered instance is in any view */
+	bool IsBoidInView(const UBoid* Boid) const;
+
+	/* Rebuild the cached neighbour candidates of every boid if any of them moved further than half of its skin */
+	void UpdateNeighbourLists();
+
+	/* Fill the NeighbourSums of every boid visiting each pair of candidates once */
+	void AccumulatePairNeighbourSums();
+
+	void RebaseSimulationOrigin(const FVector3f& NewLocalOrigin);
+
 	void ApplyPendingBoidRemovals();
 
-	// All the agents are now boids inside this Agents Manager
+	/* The field a bake writes to: Current when it can be overwritten, otherwise a new asset (editor) or transient object */
+	UObject* GetBakeTarget(UObject* Current, UClass* Class, const TCHAR* Suffix);
+
+	/* Only the bakes of the editor dirty their package */
+	void MarkBakedAssetDirty(UObject* Asset) const;
+
+	/* Drain the command queue, the only point where boids and global stimuli are added or removed */
+	void ApplyCommands();
+
+	/* Run the enabled behaviour modules over the flock and store their weighted sum in every boid */
+	void EvaluateBehaviourModules(float DeltaTime);
+
+	/* Hibernate the clusters of the flock whose region unloaded, rehydrate the hibernated clusters whose region is back */
+	void UpdateHibernation();
+
+	/* True when every World Partition cell around Bounds is activated */
+	bool IsRegionActivated(const FBox& Bounds) const;
+
+	/* Replace the boids of a cluster by a summary in HibernatedFlocks */
+	void HibernateBoids(TArrayView<UBoid* const> ClusterBoids);
+
+	/* Spawn the next boids of the hibernated flock being rehydrated */
+	void RehydrateBoids();
+
+	// All the agents are now boids inside this Agents Manager, packed and indexed by UBoid::FlockSlot
 	UPROPERTY(Category = AI, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
-	TMap<int32, UBoid*> Boids;
+	TArray<UBoid*> Boids;
 
 	UPROPERTY(Category = AI, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
-	TArray<int32> PendingBoidRemovals;
+	TArray<UBoid*> PendingBoidRemovals;
 
 	// All the global tracked stimulus
 	UPROPERTY(Category = AI, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
 	TArray<AStimulus*> GlobalStimuli;
 
-	//protect the use of the boids
-	FCriticalSection MutexBoid;
+	UPROPERTY(Category = "AI|Stats", VisibleInstanceOnly)
+	FFlockStageTimings StageTimings;
+
+	UPROPERTY(Category = "AI|Stats", VisibleInstanceOnly)
+	FFlockStatistics Statistics;
+
+	// Partial sums of the statistics blocks, kept out of the struct returned to Blueprint
+	FFlockStatisticsScratch StatisticsScratch;
+
+	// World location of the float32 local space of the boids
+	UPROPERTY(Category = AI, VisibleInstanceOnly)
+	FVector SimulationOrigin;
+
+	// Per-boid settings overrides, indexed by UBoid::SettingsOverrideIndex. Allocated separately so the
+	// settings of a boid stay valid while others are added
+	TSparseArray<TUniquePtr<FFlockBoidSettings>> SettingsOverrides;
+
+	// Hierarchical cell aggregates of the flock, rebuilt every tick
+	FFlockOctree FlockOctree;
+
+	// Packed locations and headings used to build the octree, kept to reuse the allocations
+	TArray<FVector3f> FlockLocations;
+	TArray<FVector3f> FlockHeadings;
+
+	// Impostors of the distant clusters, drawn by ImpostorMeshComponent
+	TUniquePtr<IFlockRenderAdapter> ImpostorAdapter;
+	TArray<int32> ImpostorHandles;
+	TArray<int32> ImpostorClusters;
+	TBitArray<> ImpostorSlots;
+
+	// BoidId of every slot of the octree, its slots are stale once removals repack the boids
+	TArray<int32> FlockBoidIds;
+
+	// World bounds of the boids at the start of the update
+	FBox FlockBounds;
+
+	// Global stimuli splatted in a grid
+	FFlockStimulusField StimulusField;
+
+	// Quantized state of the boids sent to the clients
+	UPROPERTY(Replicated)
+	FFlockReplicatedFlock ReplicatedFlock;
+
+	// Server: item of every boid in ReplicatedFlock by BoidId
+	TMap<int32, int32> ReplicatedItemIndices;
+
+	// Every boid by BoidId, to resolve the handles. On the clients the identifiers are the ones of the server
+	TMap<int32, UBoid*> BoidsById;
+
+	int32 NextBoidId = 0;
+
+	double NextReplicationTime = 0.0;
+
+	// Flocks waiting for their region to be loaded again
+	UPROPERTY(Category = "AI|Hibernation", VisibleInstanceOnly, SaveGame)
+	TArray<FFlockHibernationSummary> HibernatedFlocks;
+
+	// Hibernated flock being spawned again, a few boids per frame
+	int32 RehydratingFlock = INDEX_NONE;
+
+	double NextHibernationCheckTime = 0.0;
+
+	// Time at which the cluster of every hibernation cell was first seen outside the activated cells
+	TMap<FIntVector, double> UnloadedCellTimes;
+
+	// Force stream of every enabled behaviour module, kept to reuse the allocations
+	TArray<TArray<FVector3f>> BehaviourForces;
+
+	// The boids carry behaviour forces that must be cleared when the modules are disabled
+	bool bHasBehaviourForces = false;
+
+	// Frustums of the local players, empty when nobody is looking (dedicated server, commandlets)
+	TArray<FConvexVolume> ViewFrustums;
+
+	// Instances of the boids, created with the first boid
+	TUniquePtr<IFlockRenderAdapter> RenderAdapter;
+
+	// Spawns and removals invalidate the cached neighbour candidates of the boids
+	bool bNeighbourListsDirty = true;
+
+	// The pair pass needs symmetric candidate lists (built with the same radius for every boid)
+	bool bNeighbourListsSymmetric = false;
+
+	// One context per task of AccumulatePairNeighbourSums, sized to the worker threads
+	TArray<FFlockPairSumsContext> PairSumsContexts;
+
+	// Spawns, removals and stimulus changes from any thread, drained by ApplyCommands
+	TQueue<FFlockCommand, EQueueMode::Mpsc> Commands;
 };
@@ -4,10 +4,26 @@
 #include <CoreMinimal.h>
 #include <UObject/Object.h>
 
+#include "FlockOctree.h"
+#include "FlockProfile.h"
+
 #include "Boid.generated.h"
 
+class AAgent;
 class AStimulus;
 
+/* Sums over the neighbourhood of a boid, filled by the Agent before the update of the boid */
+struct FLOCKAI_API FFlockNeighbourSums
+{
+	int32 Count = 0;
+	// Sum of the unit headings of the neighbours
+	FVector3f HeadingSum = FVector3f::ZeroVector;
+	// Sum of the offsets from the boid to its neighbours
+	FVector3f CohesionSum = FVector3f::ZeroVector;
+	// Sum of the directions away from the neighbours divided by the distance to their physical radius
+	FVector3f SeparationSum = FVector3f::ZeroVector;
+};
+
 UCLASS(BlueprintType, Blueprintable)
 class FLOCKAI_API UBoid : public UObject
 {
@@ -18,12 +34,21 @@ public:
 
 	void ResetComponents();
 
-	void Init(const FVector& Location, const FRotator& Rotation, int32 MeshInstanceIndex);
+	/* Location is relative to the simulation origin of the Agent */
+	void Init(const FVector3f& Location, const FRotator& Rotation, int32 MeshInstanceIndex);
 
+	/* Generic update, every stage is enabled or skipped at runtime from the features of the settings of the boid */
 	void Update(float DeltaSeconds, AAgent* Agent);
-#if UE_ENABLE_DEBUG_DRAWING
-	void DebugDraw() const;
-#endif
+
+	/* An update compiled for one set of stages, the disabled stages are not in it */
+	using FUpdatePipeline = void (UBoid::*)(float DeltaSeconds, AAgent* Agent);
+	static FUpdatePipeline GetUpdatePipeline(EFlockFeatures Features);
+
+	/* Client proxies only: take the location (local to the Agent) and heading sent by the server */
+	void ApplyReplicatedState(const FVector3f& Location, const FVector3f& Heading);
+
+	/* Client proxies only: extrapolate the replicated state along its heading and smooth the boid toward it */
+	void UpdateProxy(float DeltaSeconds, float SmoothingSpeed, AAgent* Agent);
 
 	UFUNCTION(BlueprintCallable, Category = "AI")
 	void AddPrivateGlobalStimulus(AStimulus* Stimulus);
@@ -31,142 +56,169 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "AI")
 	void RemovePrivateGlobalStimulus(AStimulus* Stimulus);
 
+	UFUNCTION(BlueprintPure, Category = "AI")
+	FVector GetWorldLocation() const;
+
+	UFUNCTION(BlueprintPure, Category = "AI")
+	FTransform GetWorldTransform() const;
+
+	const FVector3f& GetCurrentMoveVector() const { return CurrentMoveVector; }
+
+	/* Bytes of the boid object and of the arrays it owns */
+	SIZE_T GetAllocatedSize() const;
+
+	/* The current tuning of this boid, resolved through its Agent (override, profile or default settings) */
+	const FFlockBoidSettings& GetSettings() const;
+
 protected:
-	void CalculateNewMoveVector(AAgent* Agent);
+	template <EFlockFeatures Features>
+	void UpdatePipeline(float DeltaSeconds, AAgent* Agent);
+
+	template <uint8... FeatureMasks>
+	static const FUpdatePipeline* MakeUpdatePipelines(TIntegerSequence<uint8, FeatureMasks...>);
+
+	/* The update shared by the generic and the specialised pipelines, a stage runs when its feature is in the mask */
+	void UpdateStages(float DeltaSeconds, AAgent* Agent, EFlockFeatures Features);
+
+	// Move along NewMoveVector and turn toward it
+	void IntegrateMovement(float DeltaSeconds);
+
+	// Advance the animation phase and measure the speed and turn rate of the last move
+	void UpdateAnimationState(float DeltaSeconds, const FVector3f& Displacement, const FQuat4f& PreviousRotation);
+
+	void CalculateNewMoveVector(AAgent* Agent, EFlockFeatures Features);
+	void CalculateFarFieldSample(AAgent* Agent);
 	void CalculateAlignmentComponentVector();
 	void CalculateCohesionComponentVector();
-	bool CheckStimulusVision();
+	bool CheckStimulusVision(const FVector& WorldLocation);
 	void CalculateSeparationComponentVector();
 	void ComputeAllStimuliComponentVector(AAgent* Agent);
-	void ComputeStimuliComponentVector(AAgent* Agent, AStimulus *Stimulus, const FVector& Location, bool bIsGlobal = false);
-	void CalculateNegativeStimuliComponentVector(const AStimulus* Stimulus, bool bIsGlobal = false);
-	void CalculatePositiveStimuliComponentVector(const AStimulus* Stimulus, bool bIsGlobal = false);
+	/* Add the global stimuli from the grid of the Agent, false if the boid is outside of it */
+	bool ApplyStimulusField(AAgent* Agent, const class FFlockStimulusField& StimulusField, const FVector& WorldLocation);
+	void ComputeStimuliComponentVector(AAgent* Agent, AStimulus *Stimulus, bool bIsGlobal = false);
+	void CalculateNegativeStimuliComponentVector(const AStimulus* Stimulus, const FVector3f& Direction, bool bIsGlobal = false);
+	void CalculatePositiveStimuliComponentVector(const AStimulus* Stimulus, const FVector3f& Direction, bool bIsGlobal = false);
 	void CalculateCollisionComponentVector(AAgent* Agent);
-	void ComputeAggregationOfComponents();
+	void ComputeAggregationOfComponents(EFlockFeatures Features);
 	void FindGroundLocation(AAgent* Agent, float TraceDistance, ECollisionChannel CollisionChannel = ECC_WorldStatic, float HeightOffSet = 35.0f);
 public:
-	/* The weight of the Alignment vector component */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float AlignmentWeight;
+	/* Handle of the instance of the boid in the render adapter of the Agent */
+	UPROPERTY(VisibleAnywhere , BlueprintReadOnly, Category = "AI|Steering Behavior Component")
+	int32 MeshIndex;
 
-	/* The weight of the Cohesion vector component */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float CohesionWeight;
+	/* Identifier of the boid shared by the server and the clients */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Steering Behavior Component")
+	int32 BoidId;
 
-	/* The damping of the cohesion force after sum */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float CohesionLerp;
+	/* Index of the Agent profile used by this boid */
+	UPROPERTY(VisibleAnywhere , BlueprintReadOnly, Category = "AI|Steering Behavior Component")
+	uint8 ProfileIndex;
 
-	/* The weight of the Collision vector component */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float CollisionWeight;
+	/* Index in the Agent table of per-boid overrides, INDEX_NONE when using the profile */
+	int32 SettingsOverrideIndex;
 
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	double CollisionDeviationHitAngle = PI * 10.0;
+	/* Location relative to the simulation origin of the Agent, use GetWorldLocation for world space */
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f LocalLocation;
 
-	float SeparationLerp;
-	float SeparationForce;
-	float StimuliLerp;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FQuat4f LocalRotation;
 
-	/* The weight of the Separation vector component */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float SeparationWeight;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f AlignmentComponent;
 
-	/* The base movement speed for the Agents */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float BaseMovementSpeed;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f CohesionComponent;
 
-	/* The maximum movement speed the Agents can have */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float MaxMovementSpeed;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f SeparationComponent;
 
-	/* The maximum radius at which the Agent can detect other Agents */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float VisionRadius;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f NegativeStimuliComponent;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float CollisionDistanceLook;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f PositiveStimuliComponent;
 
-	/* Speed to look at direction */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float MaxRotationSpeed;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f CollisionComponent;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	int32 MeshIndex;
-
-	UPROPERTY(EditAnywhere , BlueprintReadOnly, Category = "AI|Steering Behavior Component")
-	FTransform Transform;
+	/* Weighted sum of the behaviour modules of the Agent, written by the Agent before the update */
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f BehaviourComponent;
 
 	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector AlignmentComponent;
+	float NegativeStimuliMaxFactor;
 
 	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector CohesionComponent;
+	float PositiveStimuliMaxFactor;
 
+	/* Boids in the vision radius, only filled when the Agent does not use symmetric pair forces */
 	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector SeparationComponent;
+	TArray<UBoid*> Neighbourhood;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector NegativeStimuliComponent;
+	/* Alignment, cohesion and separation terms of the neighbourhood */
+	FFlockNeighbourSums NeighbourSums;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector PositiveStimuliComponent;
+	/* Index of the boid in the Agent, also its slot in the octree */
+	int32 FlockSlot;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector CollisionComponent;
+	/*
+	 * Set by the Agent when the boid is outside every view: it steers with its neighbours and the global stimuli only,
+	 * skips the traces and its instance is not updated until it is visible again
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Steering Behavior Component")
+	bool bOffscreen;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float NegativeStimuliMaxFactor;
+	/* Set by the Agent while the impostor of its distant cluster draws the boid, it has no instance then */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Steering Behavior Component")
+	bool bImpostor;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float PositiveStimuliMaxFactor;
+	/* Animation cycle of the boid in [0, 1), advanced with its speed */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Animation")
+	float AnimationPhase;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float InertiaWeigh;
+	/* Speed of the last move, in cm/s */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Animation")
+	float AnimationSpeed;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float BoidPhysicalRadius;
+	/* Yaw rate of the last move in radians/s, positive when turning right */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Animation")
+	float AnimationTurnRate;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	TArray<UBoid*> Neighbourhood;
+	/* Local location of the last instance transform sent to the mesh */
+	FVector3f RenderedLocation;
+
+	/* Client proxies only: last replicated location, extrapolated along the replicated heading */
+	FVector3f NetLocation;
 
 	UPROPERTY(VisibleAnywhere , BlueprintReadOnly, Category = "AI|Steering Behavior Component")
 	TArray<class AActor*> StimulusInVision;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, set boid in the floor with a trace"))
-	bool bFollowFloorZ = true;
+	/* Boids within VisionRadius + NeighbourSkinDistance at the last neighbour list build, owned by the Agent */
+	TArray<UBoid*> NeighbourCandidates;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, set boid in the floor with a trace", EditCondition = "bFollowFloorZ"))
-	float MaxFloorDistance = 1000.0f;
+	/* Local location of the boid when NeighbourCandidates was built */
+	FVector3f NeighbourListLocation;
 
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	float FloorHeightOffset = 23.0f;
-	
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, components forces will be visible"))
-	bool bEnableDebugDraw;
-
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (ClampMin=0.1f, ClampMax=10.0f))
-	float DebugRayDuration = 4.0f;
-
-	UPROPERTY(EditAnywhere , BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (ClampMin=0.1f, ClampMax=10.0f))
-	float FloorRayDuration = 0.0f;
-
-
-	const float DefaultNormalizeVectorTolerance = 0.0001f;
+	static constexpr float DefaultNormalizeVectorTolerance = 0.0001f;
 
 protected:
 	/* The movement vector (in local) this agent should move this tick. */
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
-	FVector NewMoveVector;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f NewMoveVector;
 
 	/* The movement vector (in local) this agent had last tick. */
-	UPROPERTY(EditAnywhere , BlueprintReadOnly, Category = "AI|Steering Behavior Component")
-	FVector CurrentMoveVector;
+	UPROPERTY(VisibleAnywhere, Category = "AI|Steering Behavior Component")
+	FVector3f CurrentMoveVector;
 
-	// 2 * PhysicalRadius
-	float Boid2PhysicalRadius;
+	// Shared tuning, resolved at the start of every update and only read during it: overrides can be freed and
+	// profiles swapped between updates
+	const FFlockBoidSettings* Settings;
 
 	TArray<AStimulus*> PrivateGlobalStimulus;
 
 	TSet<AStimulus*> ComputedStimulus;
+
+	// Aggregated boids between VisionRadius and FarFieldRadius
+	FFlockFarFieldSample FarField;
 };
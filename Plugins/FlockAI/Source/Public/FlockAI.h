@@ -4,8 +4,17 @@
 #define __FLOCKAI_H__
 
 #include "Modules/ModuleInterface.h"
+#include "HAL/LowLevelMemTracker.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(LogFlockAI, Log, All);
+
+// Low level memory tags of the flocks, the underscores nest them under FlockAI (-llm, stat LLMFULL)
+LLM_DECLARE_TAG_API(FlockAI, FLOCKAI_API);
+LLM_DECLARE_TAG_API(FlockAI_Boids, FLOCKAI_API);
+LLM_DECLARE_TAG_API(FlockAI_Spatial, FLOCKAI_API);
+LLM_DECLARE_TAG_API(FlockAI_Rendering, FLOCKAI_API);
+LLM_DECLARE_TAG_API(FlockAI_Navigation, FLOCKAI_API);
+LLM_DECLARE_TAG_API(FlockAI_Replication, FLOCKAI_API);
 class FFlockAIAPIModule : public IModuleInterface
 {
 	
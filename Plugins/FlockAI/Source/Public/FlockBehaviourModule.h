@@ -0,0 +1,78 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "FlockBehaviourModule.generated.h"
+
+class AAgent;
+
+/* Packed state of the flock handed to the behaviour modules, every array is indexed by UBoid::FlockSlot */
+struct FLOCKAI_API FFlockBehaviourContext
+{
+	const AAgent* Agent = nullptr;
+
+	// Locations relative to the simulation origin of the Agent
+	TArrayView<const FVector3f> Locations;
+
+	// Unit headings of the last tick
+	TArrayView<const FVector3f> Headings;
+
+	float DeltaSeconds = 0.0f;
+
+	double TimeSeconds = 0.0;
+
+	int32 Num() const { return Locations.Num(); }
+};
+
+/*
+ * A steering behaviour evaluated once per tick over the whole flock. Every module writes its own force stream, the
+ * Agent sums the streams scaled by the module weights and every boid adds the result to its move vector.
+ * Evaluate runs on worker threads over disjoint ranges of the flock, keep it a plain loop over the packed arrays so it
+ * vectorises. Modules are added to AAgent::BehaviourModules in the editor or with AAgent::AddBehaviourModule
+ */
+UCLASS(Abstract, EditInlineNew, DefaultToInstanced, CollapseCategories)
+class FLOCKAI_API UFlockBehaviourModule : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/* Game thread, before the evaluation of this tick: cache whatever Evaluate needs in the local space of the Agent */
+	virtual void PrepareEvaluation(const FFlockBehaviourContext& Context) {}
+
+	/* Write the force of the boids [Begin, End) into OutForces, it must not change the module nor the Agent */
+	virtual void Evaluate(const FFlockBehaviourContext& Context, int32 Begin, int32 End, TArrayView<FVector3f> OutForces) const
+		PURE_VIRTUAL(UFlockBehaviourModule::Evaluate, );
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour")
+	bool bEnabled = true;
+
+	/* Scale of the force stream of the module in the move vector of the boids */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour")
+	float Weight = 1.0f;
+};
+
+/* Push the boids back inside a world box, the force grows as they go deeper in the margin */
+UCLASS(meta = (DisplayName = "Bounds Containment"))
+class FLOCKAI_API UFlockBoundsModule : public UFlockBehaviourModule
+{
+	GENERATED_BODY()
+
+public:
+	virtual void PrepareEvaluation(const FFlockBehaviourContext& Context) override;
+	virtual void Evaluate(const FFlockBehaviourContext& Context, int32 Begin, int32 End, TArrayView<FVector3f> OutForces) const override;
+
+	/* World box the boids are kept in */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour")
+	FBox Bounds = FBox(FVector(-10000.0), FVector(10000.0));
+
+	/* Distance from the faces of the box where the boids start to turn back */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour", meta = (ClampMin = 1.0f))
+	float Margin = 1000.0f;
+
+protected:
+	// Bounds shrunk by the margin, in the local space of the Agent of this tick
+	FVector3f InnerMin;
+	FVector3f InnerMax;
+};
@@ -0,0 +1,43 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "Commandlets/Commandlet.h"
+#include "FlockBenchmarkCommandlet.generated.h"
+
+class AAgent;
+class AStimulus;
+
+/*
+ * Headless benchmark of the flocks, it runs every combination of the scripted scenarios for a fixed number of frames
+ * and writes the per-stage timings and the memory per boid of the Agent as JSON and CSV. -Pipelines=0 runs the generic
+ * boid update and 1 the specialised ones, so the two can be compared on the same scenarios:
+ *
+ * UnrealEditor-Cmd FlockAIGame -run=FlockBenchmark -nullrhi -unattended -Sizes=500,2000 -Spacings=100,300
+ *     -Stimuli=0,8 -Collision=0,1 -FollowFloor=0,1 -RenderBackends=ISM,HISM,Chunked
+ *     -Pipelines=0,1 -Frames=300 -Warmup=30 -DeltaSeconds=0.016667
+ *     [-Map=/Game/Maps/Main] [-Seed=1] [-Output=Saved/FlockBenchmark/Result] [-AgentClass=/Game/Blueprints/BP_Agent.BP_Agent_C]
+ */
+UCLASS()
+class UFlockBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UFlockBenchmarkCommandlet();
+
+	// Begin Commandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	// End Commandlet Interface
+
+	/* Agent spawned by every scenario, a blueprint with the boid mesh and class */
+	UPROPERTY()
+	FSoftClassPath AgentClass = FSoftClassPath(TEXT("/Game/Blueprints/BP_Agent.BP_Agent_C"));
+
+	/* Stimuli spawned by the scenarios alternate between these two classes */
+	UPROPERTY()
+	FSoftClassPath PositiveStimulusClass = FSoftClassPath(TEXT("/Game/Blueprints/BP_PositiveStimulus.BP_PositiveStimulus_C"));
+
+	UPROPERTY()
+	FSoftClassPath NegativeStimulusClass = FSoftClassPath(TEXT("/Game/Blueprints/BP_NegativeStimulus.BP_NegativeStimulus_C"));
+};
@@ -0,0 +1,69 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "Engine/EngineTypes.h"
+#include "FlockDistanceField.generated.h"
+
+/*
+ * Sparse voxel distance field of the static geometry around a flock.
+ * The volume is split in bricks of BrickSize^3 voxels; only the bricks that are closer than MaxDistance
+ * to some geometry are stored, with one byte of distance and three bytes of gradient per voxel.
+ * Distances are clamped to 0 inside the geometry and to MaxDistance far from it.
+ */
+UCLASS(BlueprintType)
+class FLOCKAI_API UFlockDistanceField : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/* Sample the geometry of the world inside InBounds, it runs a few physics queries per voxel so do it in editor or at BeginPlay */
+	void Bake(UWorld* World, const FBox& InBounds, float InVoxelSize, float InMaxDistance,
+			  ECollisionChannel ObjectType = ECC_WorldStatic, const AActor* IgnoredActor = nullptr);
+
+	/* Trilinear sample of the distance and the gradient (pointing away from the geometry), false if outside the field */
+	bool Sample(const FVector& Location, float& OutDistance, FVector& OutGradient) const;
+
+	bool IsBaked() const { return BrickIndices.Num() > 0; }
+
+	/* Bytes of the bricks and their index */
+	SIZE_T GetAllocatedSize() const;
+
+	static constexpr int32 BrickSize = 8;
+	static constexpr int32 BrickVoxels = BrickSize * BrickSize * BrickSize;
+
+	UPROPERTY(VisibleAnywhere, Category = "Distance Field")
+	FBox Bounds = FBox(ForceInit);
+
+	UPROPERTY(VisibleAnywhere, Category = "Distance Field")
+	float VoxelSize = 50.0f;
+
+	UPROPERTY(VisibleAnywhere, Category = "Distance Field")
+	float MaxDistance = 400.0f;
+
+	UPROPERTY(VisibleAnywhere, Category = "Distance Field")
+	FIntVector NumVoxels = FIntVector::ZeroValue;
+
+	UPROPERTY(VisibleAnywhere, Category = "Distance Field")
+	FIntVector NumBricks = FIntVector::ZeroValue;
+
+protected:
+	float BakeVoxel(UWorld* World, const FVector& Location, const TArray<class UPrimitiveComponent*>& Components,
+					ECollisionChannel ObjectType, const struct FCollisionQueryParams& Params) const;
+
+	void FetchVoxel(int32 X, int32 Y, int32 Z, float& OutDistance, FVector& OutGradient) const;
+
+	// Index in the brick storage for every brick of the volume, INDEX_NONE when the brick is far from everything
+	UPROPERTY()
+	TArray<int32> BrickIndices;
+
+	// Quantized distance, 0 is the surface and 255 is MaxDistance
+	UPROPERTY()
+	TArray<uint8> Distances;
+
+	// Quantized unit gradient, 3 components per voxel
+	UPROPERTY()
+	TArray<int8> Gradients;
+};
@@ -0,0 +1,111 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "Engine/EngineTypes.h"
+#include "FlockFlowField.generated.h"
+
+/*
+ * Flow fields of the flocks over the terrain.
+ * The ground inside the bounds is sampled once on a 2D grid: the height of every cell and a cost from its slope,
+ * cells too steep or without ground are blocked. For every goal the boids follow, a Dijkstra sweep from the goal
+ * stores in every cell the neighbour to move to (one byte per cell), so a boid finds its way around the terrain with
+ * a single lookup whatever the size of the flock. The goals asked by the boids during a tick are resolved once by the
+ * next UpdateGoals, the sweeps advance a bounded number of cells per tick and the fields are cached by goal cell, the
+ * previous field of a goal stays in use while it is swept again.
+ */
+UCLASS(BlueprintType)
+class FLOCKAI_API UFlockFlowField : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/* Trace the ground of every cell inside InBounds, one line trace per cell, do it in editor or at BeginPlay */
+	void Bake(UWorld* World, const FBox& InBounds, float InCellSize, float InMaxSlopeAngle,
+			  ECollisionChannel Channel = ECC_WorldStatic, const AActor* IgnoredActor = nullptr);
+
+	/* Trace again the cells inside Region (streamed terrain, a moved obstacle...), the cached goals are swept again */
+	void UpdateRegion(UWorld* World, const FBox& Region, ECollisionChannel Channel = ECC_WorldStatic, const AActor* IgnoredActor = nullptr);
+
+	/*
+	 * Direction on the floor plane to follow from Location to reach Goal. False when there is no path, at the goal
+	 * cell or while the field of the goal is not ready yet (the goal is requested and added by the next UpdateGoals)
+	 */
+	bool SampleDirection(const FVector& Goal, const FVector& Location, FVector3f& OutDirection);
+
+	/* Add the goals requested since the last call, then advance the pending sweeps settling at most MaxCells cells */
+	void UpdateGoals(int32 MaxCells);
+
+	bool IsBaked() const { return CellCosts.Num() > 0; }
+
+	/* Bytes of the baked cells and of the cached goals with their sweeps */
+	SIZE_T GetAllocatedSize() const;
+
+	UPROPERTY(VisibleAnywhere, Category = "Flow Field")
+	FBox Bounds = FBox(ForceInit);
+
+	UPROPERTY(VisibleAnywhere, Category = "Flow Field")
+	float CellSize = 200.0f;
+
+	/* Steeper cells are blocked, and so are the steps between neighbour cells steeper than this */
+	UPROPERTY(VisibleAnywhere, Category = "Flow Field")
+	float MaxSlopeAngle = 40.0f;
+
+	UPROPERTY(VisibleAnywhere, Category = "Flow Field")
+	FIntPoint NumCells = FIntPoint::ZeroValue;
+
+	/* Goals kept at once, a new goal only replaces one unused since the last UpdateGoals and waits otherwise */
+	UPROPERTY(EditAnywhere, Category = "Flow Field", meta = (ClampMin = 1))
+	int32 MaxCachedGoals = 8;
+
+	/* Sweeps (re)started by an UpdateGoals, the others wait so the started ones can finish */
+	UPROPERTY(EditAnywhere, Category = "Flow Field", meta = (ClampMin = 1))
+	int32 MaxSweepStartsPerUpdate = 2;
+
+protected:
+	struct FGoal
+	{
+		// Neighbour to move to in every cell, empty until the first sweep is done
+		TArray<uint8> Directions;
+
+		// State of the sweep in progress
+		TArray<uint8> PendingDirections;
+		TArray<float> Costs;
+		TArray<TPair<float, int32>> Open;
+		bool bSweeping = false;
+
+		// Added or traced again since its last sweep started
+		bool bNeedsSweep = true;
+
+		// Value of UpdateCount when a boid last sampled the goal
+		uint32 LastUsedUpdate = 0;
+	};
+
+	void BakeCell(UWorld* World, int32 X, int32 Y, ECollisionChannel Channel, const struct FCollisionQueryParams& Params);
+
+	void StartSweep(const FIntPoint& GoalCell, FGoal& Goal) const;
+
+	/* Settle at most MaxCells cells of the sweep, returns the number settled */
+	int32 StepSweep(FGoal& Goal, int32 MaxCells) const;
+
+	int32 GetCellIndex(const FVector& Location) const;
+
+	// Ground height of every cell
+	UPROPERTY()
+	TArray<float> Heights;
+
+	// Cost to cross every cell, 0 when blocked
+	UPROPERTY()
+	TArray<uint8> CellCosts;
+
+	// Cached goals by goal cell
+	TMap<FIntPoint, FGoal> Goals;
+
+	// Goal cells sampled since the last UpdateGoals that are not cached
+	TSet<FIntPoint> RequestedGoals;
+
+	// Calls to UpdateGoals
+	uint32 UpdateCount = 0;
+};
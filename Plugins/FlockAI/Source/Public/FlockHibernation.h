@@ -0,0 +1,57 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockHibernation.generated.h"
+
+namespace FlockHibernation
+{
+	// Cells per axis of the coarse distribution of a hibernated flock
+	constexpr int32 GridSize = 4;
+	constexpr int32 NumCells = GridSize * GridSize * GridSize;
+	// Random yaw added to the heading of the rehydrated boids, in degrees
+	constexpr float HeadingSpread = 15.0f;
+}
+
+/*
+ * Compact state of a flock whose World Partition region is not loaded: its centroid, mean heading, count, bounds
+ * and how the boids were spread in a 4x4x4 grid over the bounds and between the profiles (~200 bytes whatever the
+ * size of the flock). The boids are destroyed while hibernated and spawned again from the summary, frozen where they
+ * were. Per-boid settings overrides and private stimuli are not kept
+ */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockHibernationSummary
+{
+	GENERATED_BODY()
+
+	/* Summarize the boids, the three arrays are indexed by the same boid */
+	void Build(TArrayView<const FVector> Locations, TArrayView<const FVector3f> Headings, TArrayView<const uint8> ProfileIndices);
+
+	/* Take one boid out of the summary, placed randomly in the cell it was in. False when the summary is empty */
+	bool PopBoid(FVector& OutLocation, FRotator& OutRotation, uint8& OutProfileIndex);
+
+	bool IsEmpty() const { return Count == 0; }
+
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	FVector Centroid = FVector::ZeroVector;
+
+	/* Mean heading of the boids, unit */
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	FVector3f Heading = FVector3f::ForwardVector;
+
+	/* Boids left to rehydrate */
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	int32 Count = 0;
+
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	FBox Bounds = FBox(ForceInit);
+
+	/* Boids left in every cell of the grid over Bounds, X first */
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	TArray<uint16> CellCounts;
+
+	/* Boids left of every profile index */
+	UPROPERTY(VisibleInstanceOnly, SaveGame, Category = "AI|Hibernation")
+	TArray<int32> ProfileCounts;
+};
@@ -0,0 +1,98 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+
+/* Aggregated contribution of the boids outside the vision radius of a boid */
+struct FLOCKAI_API FFlockFarFieldSample
+{
+	int32 Count = 0;
+	FVector3f LocationSum = FVector3f::ZeroVector;
+	FVector3f HeadingSum = FVector3f::ZeroVector;
+};
+
+/*
+ * Octree rebuilt every tick from the boid locations of an Agent.
+ * Every node stores the aggregates of the boids below it (count, centroid and the sum of unit headings)
+ * so far away cells can be used as a single boid (Barnes-Hut), and the items are stored sorted by node
+ * so every node covers a contiguous range of them.
+ */
+class FLOCKAI_API FFlockOctree
+{
+public:
+	struct FNode
+	{
+		FVector3f Center = FVector3f::ZeroVector;
+		float HalfSize = 0.0f;
+		FVector3f Centroid = FVector3f::ZeroVector;
+		FVector3f HeadingSum = FVector3f::ZeroVector;
+		int32 FirstItem = 0;
+		int32 NumItems = 0;
+		int32 FirstChild = INDEX_NONE;
+		int32 NumChildren = 0;
+
+		bool IsLeaf() const { return NumChildren == 0; }
+	};
+
+	/* Rebuild the tree, Locations and Headings are indexed by the slot of the boid in the Agent */
+	void Build(TArrayView<const FVector3f> Locations, TArrayView<const FVector3f> Headings);
+
+	void Reset();
+
+	/* Size the buffers for NumItems boids */
+	void Reserve(int32 NumItems);
+
+	SIZE_T GetAllocatedSize() const;
+
+	/*
+	 * Sum the boids in the shell (NearRadius, FarRadius] around Location.
+	 * Cells fully outside NearRadius are aggregated when CellSize / DistanceToCentroid < OpeningAngle,
+	 * an OpeningAngle of 0 visits every boid of the shell.
+	 */
+	void AccumulateFarField(const FVector3f& Location, float NearRadius, float FarRadius, float OpeningAngle, FFlockFarFieldSample& OutSample) const;
+
+	/* Append the slots of the boids within Radius of Center */
+	void QuerySphere(const FVector3f& Center, float Radius, TArray<int32>& OutSlots) const;
+
+	/* Append the slots of the boids inside Box */
+	void QueryBox(const FBox3f& Box, TArray<int32>& OutSlots) const;
+
+	/*
+	 * Append the slots of the Count boids closest to Center within MaxRadius, the closest first. Slots rejected by
+	 * IsSlotValid (boids removed since the build) do not count, the search goes on until Count valid ones are found
+	 */
+	void QueryNearest(const FVector3f& Center, int32 Count, float MaxRadius, TArray<int32>& OutSlots,
+					  TFunctionRef<bool(int32 Slot)> IsSlotValid = [](int32) { return true; }) const;
+
+	/*
+	 * Cut the tree into the largest cells farther than MinDistance from every view and seen under less than MaxAngle
+	 * (cell size over distance). The boids of the cells left out are close to a view
+	 */
+	void CollectClusters(TArrayView<const FVector3f> Views, float MinDistance, float MaxAngle, TArray<int32>& OutNodes) const;
+
+	const FNode& GetNode(int32 NodeIndex) const { return Nodes[NodeIndex]; }
+
+	/* Slots of the boids below a node */
+	TArrayView<const int32> GetNodeSlots(int32 NodeIndex) const { return MakeArrayView(&SortedSlots[Nodes[NodeIndex].FirstItem], Nodes[NodeIndex].NumItems); }
+
+	int32 Num() const { return SortedSlots.Num(); }
+	bool IsEmpty() const { return Nodes.Num() == 0; }
+
+	static constexpr int32 MaxLeafItems = 8;
+	static constexpr int32 MaxDepth = 16;
+
+private:
+	void BuildNode(int32 NodeIndex, int32 Depth);
+
+	TArray<FNode> Nodes;
+	TArray<int32> SortedSlots;
+	TArray<FVector3f> SortedLocations;
+	TArray<FVector3f> SortedHeadings;
+
+	// Scratch buffers for the octant partition
+	TArray<int32> PartitionSlots;
+	TArray<FVector3f> PartitionLocations;
+	TArray<FVector3f> PartitionHeadings;
+};
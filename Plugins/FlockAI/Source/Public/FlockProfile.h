@@ -0,0 +1,165 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "FlockProfile.generated.h"
+
+/* Stages of the boid update. Every flock runs an update compiled for the stages its settings enable */
+enum class EFlockFeatures : uint8
+{
+	None = 0,
+	Alignment = 1 << 0,
+	Cohesion = 1 << 1,
+	Separation = 1 << 2,
+	Stimuli = 1 << 3,
+	Collision = 1 << 4,
+	FollowFloor = 1 << 5,
+	All = (1 << 6) - 1
+};
+ENUM_CLASS_FLAGS(EFlockFeatures)
+
+/* Tuning shared by all the boids of a flock, the boids only keep their own state */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockBoidSettings
+{
+	GENERATED_BODY()
+
+	/* The weight of the Alignment vector component */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float AlignmentWeight = 1.0f;
+
+	/* The weight of the Cohesion vector component */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float CohesionWeight = 1.0f;
+
+	/* The damping of the cohesion force after sum */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float CohesionLerp = 100.0f;
+
+	/* The weight of the Collision vector component */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float CollisionWeight = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	double CollisionDeviationHitAngle = PI * 10.0;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float SeparationLerp = 5.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float SeparationForce = 100.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float StimuliLerp = 100.0f;
+
+	/* Disable it for flocks that never react to stimuli, they skip the stimulus overlaps of every boid */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	bool bReactToStimuli = true;
+
+	/* The weight of the Separation vector component */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float SeparationWeight = 0.8f;
+
+	/* The base movement speed for the Agents */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float BaseMovementSpeed = 150.0f;
+
+	/* The maximum movement speed the Agents can have */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float MaxMovementSpeed = 250.0f;
+
+	/* The maximum radius at which the Agent can detect other Agents */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float VisionRadius = 400.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float CollisionDistanceLook = 400.0f;
+
+	/*
+	 * Extra radius of the cached neighbour candidates (VisionRadius + skin). The lists are only rebuilt when a boid
+	 * has moved more than half of the skin since the last build, 0 rebuilds them every tick
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (ClampMin = 0.0f))
+	float NeighbourSkinDistance = 100.0f;
+
+	/* If enabled, boids outside the vision radius contribute to cohesion and alignment through aggregated octree cells */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component|Far Field")
+	bool bUseFarField = false;
+
+	/* The maximum radius at which the Agent feels the rest of the flock as aggregated cells */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component|Far Field", meta = (EditCondition = "bUseFarField"))
+	float FarFieldRadius = 4000.0f;
+
+	/* A cell of size S at distance D is used as a single boid when S / D is below this angle, 0 visits every boid (exact but slow) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component|Far Field", meta = (EditCondition = "bUseFarField", ClampMin = 0.0f, ClampMax = 2.0f))
+	float FarFieldOpeningAngle = 0.5f;
+
+	/* The weight of every far boid compared to a boid of the Neighbourhood */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component|Far Field", meta = (EditCondition = "bUseFarField"))
+	float FarFieldWeight = 0.25f;
+
+	/* Speed to look at direction */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float MaxRotationSpeed = 6.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float InertiaWeigh = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float BoidPhysicalRadius = 45.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, set boid in the floor with a trace"))
+	bool bFollowFloorZ = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, set boid in the floor with a trace", EditCondition = "bFollowFloorZ"))
+	float MaxFloorDistance = 1000.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component")
+	float FloorHeightOffset = 23.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (Tooltip = "If enabled, components forces will be visible, sampled by the DebugDraw settings of the Agent"))
+	bool bEnableDebugDraw = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (ClampMin = 0.1f, ClampMax = 10.0f))
+	float DebugRayDuration = 0.12f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Steering Behavior Component", meta = (ClampMin = 0.1f, ClampMax = 10.0f))
+	float FloorRayDuration = 0.0f;
+
+	/* Animation cycles per second of a boid standing still */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Animation", meta = (ClampMin = 0.0f))
+	float AnimationIdleRate = 0.5f;
+
+	/* Distance travelled during one animation cycle, the faster boids flap or swim faster. Zero keeps the idle rate */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Animation", meta = (ClampMin = 0.0f))
+	float AnimationStrideLength = 300.0f;
+
+	// 2 * PhysicalRadius
+	float GetBoid2PhysicalRadius() const { return 2.0f * BoidPhysicalRadius; }
+
+	/* Stages of the update enabled by these settings, a zero weight disables its stage */
+	EFlockFeatures GetFeatures() const
+	{
+		EFlockFeatures Features = EFlockFeatures::None;
+		Features |= AlignmentWeight != 0.0f ? EFlockFeatures::Alignment : EFlockFeatures::None;
+		Features |= CohesionWeight != 0.0f ? EFlockFeatures::Cohesion : EFlockFeatures::None;
+		Features |= SeparationWeight != 0.0f ? EFlockFeatures::Separation : EFlockFeatures::None;
+		Features |= bReactToStimuli ? EFlockFeatures::Stimuli : EFlockFeatures::None;
+		Features |= CollisionWeight != 0.0f ? EFlockFeatures::Collision : EFlockFeatures::None;
+		Features |= bFollowFloorZ ? EFlockFeatures::FollowFloor : EFlockFeatures::None;
+		return Features;
+	}
+};
+
+/* Data asset with the tuning of a flock, the Agent references it by index so a whole flock can be tuned live */
+UCLASS(BlueprintType)
+class FLOCKAI_API UFlockProfile : public UPrimaryDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI", meta = (ShowOnlyInnerProperties))
+	FFlockBoidSettings Settings;
+};
@@ -0,0 +1,63 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockRenderAdapter.generated.h"
+
+class UInstancedStaticMeshComponent;
+
+UENUM(BlueprintType)
+enum class EFlockRenderBackend : uint8
+{
+	/* A single instanced mesh component, moving instances does not rebuild any cluster tree */
+	InstancedStaticMesh,
+	/* The hierarchical instanced mesh of the Agent, its cluster tree suits flocks that barely move */
+	HierarchicalInstancedStaticMesh,
+	/* One instanced mesh component per cell of the world, so the cells out of view are culled as a whole */
+	ChunkedInstancedStaticMesh
+};
+
+/*
+ * Draws the boids of an Agent, the simulation only knows the handles it gets when adding instances.
+ * A handle stays valid until its instance is removed, whatever the backend does with the instance indices.
+ */
+class FLOCKAI_API IFlockRenderAdapter
+{
+public:
+	virtual ~IFlockRenderAdapter() = default;
+
+	/* Add an instance at a world transform and return its handle */
+	virtual int32 AddInstance(const FTransform& WorldTransform) = 0;
+
+	virtual void RemoveInstance(int32 Handle) = 0;
+
+	/* The new transforms are buffered and sent to the components in a batch by Flush */
+	virtual void SetInstanceTransform(int32 Handle, const FTransform& WorldTransform) = 0;
+
+	/* The custom data floats of the instance, as many as given to Create. Buffered and sent by Flush too */
+	virtual void SetInstanceCustomData(int32 Handle, TArrayView<const float> CustomData) = 0;
+
+	virtual void Flush() = 0;
+
+	virtual int32 Num() const = 0;
+
+	virtual int32 GetNumCustomData() const = 0;
+
+	/* Size the instance storage for NumInstances instances */
+	virtual void Reserve(int32 NumInstances) = 0;
+
+	/* Bytes of the instance data kept by the adapter and its components on the game thread */
+	virtual SIZE_T GetAllocatedSize() const = 0;
+
+	/* Destroy the components created by the adapter */
+	virtual void Release() = 0;
+
+	/*
+	 * Template is the mesh component of the Agent. The hierarchical backend draws with it, so does the instanced backend
+	 * when the template is a plain instanced mesh, the others copy its mesh and materials. ChunkSize is the size of the cells of the chunked backend. NumCustomData is the number of
+	 * custom data floats of every instance
+	 */
+	static TUniquePtr<IFlockRenderAdapter> Create(EFlockRenderBackend Backend, UInstancedStaticMeshComponent* Template, float ChunkSize,
+												  int32 NumCustomData = 0);
+};
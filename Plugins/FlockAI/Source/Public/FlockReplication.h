@@ -0,0 +1,112 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Net/Serialization/FastArraySerializer.h"
+#include "FlockReplication.generated.h"
+
+class AAgent;
+struct FFlockReplicatedFlock;
+
+/*
+ * Replicated state of the flocks.
+ *
+ * Every boid is an item of a fast array, only the items marked dirty by the server are sent. A boid is written as
+ * its id (packed, ~2 bytes), profile (1 byte), the cell of the world it is in (3 x int16), its location in the cell
+ * (3 x 12 bits, 1 cm steps) and its heading (10 bits of yaw and 6 of pitch, level headings are exact): about
+ * 16 bytes plus ~2 bytes of fast array header per boid. Estimated bandwidth for 1k boids at NetUpdateFrequency 10:
+ *   - every boid dirty every update: ~180 KB/s
+ *   - MaxReplicatedBoidsPerUpdate 256: ~46 KB/s whatever the size of the flock
+ * The clients extrapolate every boid from its last state (location + heading x BaseMovementSpeed x time since it was
+ * sent). A boid is only sent again when it is further than ReplicationDistanceThreshold from that prediction or has
+ * turned more than ReplicationHeadingThreshold, so boids flying straight cost nothing and the cap goes to the ones
+ * that turn or change speed. Flocks that turn all the time (tight cohesion, many stimuli) still reach the cap.
+ */
+namespace FlockReplication
+{
+	// Side of the cells the locations are quantized in
+	constexpr double CellSize = 4096.0;
+	constexpr int32 OffsetBits = 12;
+	constexpr uint32 OffsetMax = (1u << OffsetBits) - 1;
+	constexpr int32 YawBits = 10;
+	constexpr int32 PitchBits = 6;
+	// Yaw wraps around, -PI and PI share a code and 0 is exact
+	constexpr uint32 YawCodes = 1u << YawBits;
+	// Odd number of pitch levels (the last code is unused) so a level heading is exact
+	constexpr uint32 PitchSteps = (1u << PitchBits) - 2;
+}
+
+USTRUCT()
+struct FLOCKAI_API FFlockReplicatedBoid : public FFastArraySerializerItem
+{
+	GENERATED_BODY()
+
+	/* Quantize a world location and a heading into the item, sent at world time Time */
+	void Pack(const FVector& WorldLocation, const FVector3f& InHeading, double Time);
+
+	FVector GetWorldLocation() const;
+	FVector3f GetHeading() const;
+
+	/* Where the clients extrapolate the boid at world time Time, Speed is the BaseMovementSpeed of the boid */
+	FVector GetPredictedLocation(double Time, float Speed) const;
+
+	bool NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess);
+
+	// Client side callbacks of the fast array
+	void PreReplicatedRemove(const FFlockReplicatedFlock& InArraySerializer);
+	void PostReplicatedAdd(const FFlockReplicatedFlock& InArraySerializer);
+	void PostReplicatedChange(const FFlockReplicatedFlock& InArraySerializer);
+
+	UPROPERTY()
+	uint32 BoidId = 0;
+
+	UPROPERTY()
+	uint8 ProfileIndex = 0;
+
+	int16 CellX = 0;
+	int16 CellY = 0;
+	int16 CellZ = 0;
+	uint16 OffsetX = 0;
+	uint16 OffsetY = 0;
+	uint16 OffsetZ = 0;
+	uint16 Heading = 0;
+
+	// Server: world time of the last Pack, not replicated
+	double PackTime = 0.0;
+};
+
+template<>
+struct TStructOpsTypeTraits<FFlockReplicatedBoid> : public TStructOpsTypeTraitsBase2<FFlockReplicatedBoid>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
+
+USTRUCT()
+struct FLOCKAI_API FFlockReplicatedFlock : public FFastArraySerializer
+{
+	GENERATED_BODY()
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FFlockReplicatedBoid, FFlockReplicatedFlock>(Items, DeltaParms, *this);
+	}
+
+	UPROPERTY()
+	TArray<FFlockReplicatedBoid> Items;
+
+	// Owner of the array, it creates and moves the client proxies of the boids
+	AAgent* Agent = nullptr;
+};
+
+template<>
+struct TStructOpsTypeTraits<FFlockReplicatedFlock> : public TStructOpsTypeTraitsBase2<FFlockReplicatedFlock>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
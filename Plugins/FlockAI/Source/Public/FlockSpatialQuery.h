@@ -0,0 +1,82 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockSpatialQuery.generated.h"
+
+/* Reference to a boid that survives the removals of other boids, resolve it with AAgent::ResolveBoid */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockBoidHandle
+{
+	GENERATED_BODY()
+
+	FFlockBoidHandle() = default;
+	explicit FFlockBoidHandle(int32 InBoidId) : BoidId(InBoidId) {}
+
+	/* UBoid::BoidId of the boid, shared by the server and the clients. Zero is no boid */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Query")
+	int32 BoidId = 0;
+
+	bool IsValid() const { return BoidId != 0; }
+
+	bool operator==(const FFlockBoidHandle& Other) const { return BoidId == Other.BoidId; }
+	bool operator!=(const FFlockBoidHandle& Other) const { return BoidId != Other.BoidId; }
+	friend uint32 GetTypeHash(const FFlockBoidHandle& Handle) { return ::GetTypeHash(Handle.BoidId); }
+};
+
+UENUM(BlueprintType)
+enum class EFlockQueryShape : uint8
+{
+	/* The boids within Radius of Origin */
+	Sphere,
+	/* The boids within Radius of Origin and HalfAngle of Direction */
+	Cone,
+	/* The boids inside the box of half size Extent around Origin */
+	Box,
+	/* The MaxResults boids closest to Origin, within Radius when it is not zero. With zero MaxResults every boid in Radius, sorted */
+	Nearest
+};
+
+/* A query over the boids of an Agent, in world space */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockSpatialQuery
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query")
+	EFlockQueryShape Shape = EFlockQueryShape::Sphere;
+
+	/* Center of the sphere, the box and the nearest search, apex of the cone */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query")
+	FVector Origin = FVector::ZeroVector;
+
+	/* Radius of the sphere, length of the cone, farthest boid of the nearest search when not zero */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query", meta = (ClampMin = 0.0f))
+	float Radius = 1000.0f;
+
+	/* Axis of the cone */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query", meta = (EditCondition = "Shape == EFlockQueryShape::Cone"))
+	FVector Direction = FVector::ForwardVector;
+
+	/* Angle between the axis and the side of the cone, in degrees */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query", meta = (ClampMin = 0.0f, ClampMax = 180.0f, EditCondition = "Shape == EFlockQueryShape::Cone"))
+	float HalfAngle = 30.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query", meta = (EditCondition = "Shape == EFlockQueryShape::Box"))
+	FVector Extent = FVector(500.0);
+
+	/* The K of the nearest search, for the other shapes the boids past MaxResults are dropped. Zero keeps them all */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Query", meta = (ClampMin = 0))
+	int32 MaxResults = 0;
+};
+
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockSpatialQueryResult
+{
+	GENERATED_BODY()
+
+	/* Unordered, except for the nearest search where the closest boid comes first */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "AI|Query")
+	TArray<FFlockBoidHandle> Boids;
+};
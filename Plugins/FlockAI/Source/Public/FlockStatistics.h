@@ -0,0 +1,93 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FlockStatistics.generated.h"
+
+namespace FlockStatistics
+{
+	// Boids reduced by every task, each task also owns a copy of the density histogram
+	constexpr int32 BlockSize = 4096;
+	// Cells per axis of the density histogram at most
+	constexpr int32 MaxDensityResolution = 64;
+}
+
+struct FFlockStatisticsScratch;
+
+/*
+ * Flock-wide figures for the systems that watch the flock as a whole (directors, music, spawners): count, centroid,
+ * bounds, mean heading and its spread, and a top-down density histogram over the bounds with its busiest cell.
+ * Reduced by the Agent from the packed locations and headings of the octree build, in blocks that run in parallel
+ */
+USTRUCT(BlueprintType)
+struct FLOCKAI_API FFlockStatistics
+{
+	GENERATED_BODY()
+
+	/*
+	 * Reduce the boids, Locations and Headings are in the local space of Origin and LocalBounds contains every location.
+	 * Scratch holds the partial sums of the blocks, owned by the caller so it is kept between builds
+	 */
+	void Build(TArrayView<const FVector3f> Locations, TArrayView<const FVector3f> Headings, const FBox3f& LocalBounds, const FVector& Origin,
+			   int32 Resolution, FFlockStatisticsScratch& Scratch);
+
+	void Reset();
+
+	/* Boids in the histogram cell of a world location, zero outside the bounds */
+	int32 GetDensityAt(const FVector& WorldLocation) const;
+
+	SIZE_T GetAllocatedSize() const;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int32 NumBoids = 0;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	FVector Centroid = FVector::ZeroVector;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	FBox Bounds = FBox(ForceInit);
+
+	/* Mean heading of the moving boids, unit */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	FVector Heading = FVector::ForwardVector;
+
+	/* 0 when every boid heads the same way, 1 when the headings cancel out. The boids standing still are left out */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	float HeadingSpread = 0.0f;
+
+	/* Cells per axis of Density */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int32 DensityResolution = 0;
+
+	/* Boids in every column of a grid over the XY of Bounds, X first */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	TArray<int32> Density;
+
+	/* Center of the busiest cell of Density, at the height of the centroid */
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	FVector HotspotLocation = FVector::ZeroVector;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "AI|Stats")
+	int32 HotspotCount = 0;
+
+private:
+	int32 GetDensityCell(const FVector3f& LocalLocation, const FBox3f& LocalBounds) const;
+};
+
+/* Partial sums and histograms of the blocks of FFlockStatistics::Build */
+struct FLOCKAI_API FFlockStatisticsScratch
+{
+	struct FBlock
+	{
+		FVector LocationSum = FVector::ZeroVector;
+		FVector3f HeadingSum = FVector3f::ZeroVector;
+		// Boids with a heading, the ones standing still have none
+		int32 NumHeadings = 0;
+	};
+
+	TArray<FBlock> Blocks;
+	TArray<int32> BlockDensity;
+
+	SIZE_T GetAllocatedSize() const { return Blocks.GetAllocatedSize() + BlockDensity.GetAllocatedSize(); }
+};
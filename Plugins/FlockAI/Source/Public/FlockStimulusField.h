@@ -0,0 +1,109 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AStimulus;
+
+/* Contribution of all the global stimuli at a location, in the terms used by the boids */
+struct FLOCKAI_API FFlockStimulusSample
+{
+	// Sum of the push of the negative stimuli, to be scaled by the StimuliLerp of the boid
+	FVector3f NegativeSum = FVector3f::ZeroVector;
+	float NegativeMaxFactor = 0.0f;
+
+	// Sum of the pull of the positive stimuli stronger than every previous one, in the order of the Agent
+	FVector3f PositiveSum = FVector3f::ZeroVector;
+	float PositiveMaxFactor = 0.0f;
+};
+
+/*
+ * The global stimuli of an Agent splatted into a coarse 3D grid over the flock and the stimuli.
+ * Every grid point stores the sample of the stimuli far from it, so a boid pays one trilinear lookup whatever the
+ * number of stimuli. The stimuli in the cell of the boid and the adjacent ones are evaluated exactly instead, their
+ * kernels are too steep near them to be sampled, and the ones two cells away fade from the exact evaluation to the grid
+ * across the cell so the sample stays continuous. Every cell also lists the positive stimuli close enough to be consumed
+ * from it. Added, removed, moved or changed stimuli are splatted in and out of the grid one by one, the grid is only
+ * rebuilt when the flock or a stimulus leaves it.
+ * Far negative stimuli are evaluated with the physical radius given to Build instead of the radius of every boid.
+ */
+class FLOCKAI_API FFlockStimulusField
+{
+public:
+	/* Splat the stimuli that changed since the last update, rebuild the grid when it does not cover them or the flock */
+	void Update(TArrayView<AStimulus* const> InStimuli, const FBox& FlockBounds, float CellSize, float PhysicalRadius, float ConsumeRadius);
+
+	/* Rebuild the grid over FlockBounds and the stimuli, cells grow above CellSize to keep the grid coarse */
+	void Build(TArrayView<AStimulus* const> InStimuli, const FBox& FlockBounds, float CellSize, float PhysicalRadius, float ConsumeRadius);
+
+	void Reset();
+
+	/*
+	 * Trilinear sample of the far stimuli plus the near ones evaluated with PhysicalRadius, the near stimuli in
+	 * SkippedStimuli are left out (already evaluated by the boid). False outside the grid
+	 */
+	bool Sample(const FVector& WorldLocation, float PhysicalRadius, const TSet<AStimulus*>& SkippedStimuli, FFlockStimulusSample& OutSample) const;
+
+	/* Positive stimuli that can be consumed from the cell of WorldLocation */
+	void GetConsumableStimuli(const FVector& WorldLocation, TArray<AStimulus*, TInlineAllocator<4>>& OutStimuli) const;
+
+	/* True if the stimulus is splatted in the grid */
+	bool Contains(const AStimulus* Stimulus) const { return States.Contains(Stimulus); }
+
+	/* True if the stimulus is in the cell of WorldLocation or an adjacent one, Sample evaluates it in full there */
+	bool IsAdjacent(const AStimulus* Stimulus, const FVector& WorldLocation) const;
+
+	/* Location of the strongest positive stimulus, the goal of the positive pull */
+	bool GetStrongestPositive(FVector& OutLocation) const;
+
+	bool IsBuilt() const { return Points.Num() > 0; }
+
+	SIZE_T GetAllocatedSize() const;
+
+	// Grid points per axis at most
+	static constexpr int32 MaxPointsPerAxis = 64;
+
+private:
+	struct FStimulusState
+	{
+		FVector Location = FVector::ZeroVector;
+		float Value = 0.0f;
+		float Radius = 0.0f;
+		// The grid points around this cell leave the stimulus to the exact evaluation
+		FIntVector Cell = FIntVector::ZeroValue;
+		// Stronger than every previous positive stimulus of the Agent, only those pull the boids
+		bool bRecord = false;
+	};
+
+	int32 GetCellIndex(const FVector& WorldLocation) const;
+
+	// Cell of a location inside the grid, clamped to the last cell on the max bounds
+	FIntVector GetCell(const FVector& WorldLocation) const;
+
+	// Add (Sign 1) or take out (Sign -1) the contribution of a stimulus to the grid points far from it
+	void Splat(const FStimulusState& State, float Sign);
+
+	// Far contribution of a stimulus to a grid point
+	void AddToPoint(const FStimulusState& State, const FIntVector& PointCoords, float Sign, FFlockStimulusSample& Point) const;
+
+	// List the stimulus in the near and consumable cells around it, or take it out of them
+	void LinkCells(AStimulus* Stimulus, const FStimulusState& State, bool bLink);
+
+	FVector Origin = FVector::ZeroVector;
+	double CellSize = 0.0;
+	FIntVector NumPoints = FIntVector::ZeroValue;
+	FBox Bounds = FBox(ForceInit);
+	float SplatPhysicalRadius = 0.0f;
+	float SplatConsumeRadius = 0.0f;
+
+	TArray<FFlockStimulusSample> Points;
+	TMap<int32, TArray<AStimulus*, TInlineAllocator<2>>> ConsumableStimuli;
+	// Stimuli within two cells of every cell, evaluated exactly by its boids
+	TMap<int32, TArray<AStimulus*, TInlineAllocator<2>>> NearStimuli;
+
+	// State of the stimuli when they were splatted
+	TMap<AStimulus*, FStimulusState> States;
+	AStimulus* StrongestPositive = nullptr;
+	float StrongestPositiveValue = 0.0f;
+};
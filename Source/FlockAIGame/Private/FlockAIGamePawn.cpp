@@ -2,6 +2,7 @@
 
 #include "FlockAIGamePawn.h"
 #include "FlockAIGame.h"
+#include "FlockBehaviourModule.h"
 
 namespace FlockAIGamePawn
 {
@@ -56,7 +57,10 @@ void AFlockAIGamePawn::BeginPlay()
 {
 	Super::BeginPlay();
 	AgentInstances.Empty(1);
-	SpawnAgent();
+	if (HasAuthority())
+	{
+		SpawnAgent();
+	}
 }
 
 // Called every frame
@@ -184,31 +188,58 @@ void AFlockAIGamePawn::DoSpawning()
 {
 	if (bWantToSpawn)
 	{
-		if (CurrentGamemode == EFlockAIGamemode::EGM_SpawnNewAgents)
-		{
-			if (AgentInstances.Num() == 0 || !AgentInstances.IsValidIndex(CurrentAgentIndex) || !IsValid(AgentInstances[CurrentAgentIndex]))
-			{
-				SpawnAgent();
-			}
-			check(AgentInstances[CurrentAgentIndex]);
-			AgentInstances[CurrentAgentIndex]->SpawnBoid(PreviewMeshComponent->GetComponentLocation(), PreviewMeshComponent->GetComponentRotation());
-		}
-		else if (CurrentGamemode == EFlockAIGamemode::EGM_SpawnPositiveStimuli)
+		const FVector Location = CurrentGamemode == EFlockAIGamemode::EGM_SpawnNewAgents
+			? PreviewMeshComponent->GetComponentLocation()
+			: SpawningLocation;
+		if (HasAuthority())
 		{
-			GetWorld()->SpawnActor<AStimulus>(PositiveStimulusBP, SpawningLocation, FRotator::ZeroRotator);
+			SpawnSelection(CurrentGamemode, Location, PreviewMeshComponent->GetComponentRotation());
 		}
-		else if (CurrentGamemode == EFlockAIGamemode::EGM_SpawnNegativeStimuli)
+		else
 		{
-			GetWorld()->SpawnActor<AStimulus>(NegativeStimulusBP, SpawningLocation, FRotator::ZeroRotator);
+			ServerSpawnSelection(CurrentGamemode, Location, PreviewMeshComponent->GetComponentRotation());
 		}
 
 		CancelSpawning();
 	}
 }
 
+void AFlockAIGamePawn::ServerSpawnSelection_Implementation(EFlockAIGamemode Gamemode, FVector Location, FRotator Rotation)
+{
+	SpawnSelection(Gamemode, Location, Rotation);
+}
+
+void AFlockAIGamePawn::SpawnSelection(EFlockAIGamemode Gamemode, const FVector& Location, const FRotator& Rotation)
+{
+	if (Gamemode == EFlockAIGamemode::EGM_SpawnNewAgents)
+	{
+		if (AgentInstances.Num() == 0 || !AgentInstances.IsValidIndex(CurrentAgentIndex) || !IsValid(AgentInstances[CurrentAgentIndex]))
+		{
+			SpawnAgent();
+		}
+		check(AgentInstances[CurrentAgentIndex]);
+		AgentInstances[CurrentAgentIndex]->SpawnBoid(Location, Rotation);
+	}
+	else if (Gamemode == EFlockAIGamemode::EGM_SpawnPositiveStimuli)
+	{
+		GetWorld()->SpawnActor<AStimulus>(PositiveStimulusBP, Location, FRotator::ZeroRotator);
+	}
+	else if (Gamemode == EFlockAIGamemode::EGM_SpawnNegativeStimuli)
+	{
+		GetWorld()->SpawnActor<AStimulus>(NegativeStimulusBP, Location, FRotator::ZeroRotator);
+	}
+}
+
 void AFlockAIGamePawn::SpawnAgent()
 {
 	AAgent* Agent = GetWorld()->SpawnActor<AAgent>(AgentBP, FVector::ZeroVector, FRotator::ZeroRotator);
+	for (const TSubclassOf<UFlockBehaviourModule>& ModuleClass : AgentBehaviourModules)
+	{
+		if (ModuleClass)
+		{
+			Agent->AddBehaviourModule(NewObject<UFlockBehaviourModule>(Agent, ModuleClass));
+		}
+	}
 	CurrentAgentIndex = AgentInstances.AddUnique(Agent);
 	OnAgentSpawned(Agent);
 }
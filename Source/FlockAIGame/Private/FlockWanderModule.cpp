@@ -0,0 +1,19 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#include "FlockWanderModule.h"
+#include "FlockAIGame.h"
+
+void UFlockWanderModule::Evaluate(const FFlockBehaviourContext& Context, int32 Begin, int32 End, TArrayView<FVector3f> OutForces) const
+{
+	const float Frequency = 2.0f * PI / WanderWavelength;
+	const float Phase = static_cast<float>(FMath::Fmod(Context.TimeSeconds * WanderRate, 1.0) * 2.0 * PI);
+	for (int32 Slot = Begin; Slot < End; ++Slot)
+	{
+		const FVector3f& Location = Context.Locations[Slot];
+		const FVector3f& Heading = Context.Headings[Slot];
+		const float Side = FMath::Sin(Location.X * Frequency + Phase) * FMath::Cos(Location.Y * Frequency - Phase);
+
+		// Perpendicular to the heading on the floor plane
+		OutForces[Slot] = FVector3f(-Heading.Y, Heading.X, 0.0f) * Side;
+	}
+}
@@ -76,6 +76,10 @@ public:
 	UPROPERTY(Category = Spawn, EditDefaultsOnly)
 	TSubclassOf<AAgent> AgentBP;
 
+	// Behaviour modules added to every spawned Agent, like UFlockWanderModule
+	UPROPERTY(Category = Spawn, EditDefaultsOnly)
+	TArray<TSubclassOf<class UFlockBehaviourModule>> AgentBehaviourModules;
+
 	// The class of the Negative Stimulus to spawn
 	UPROPERTY(Category = Spawn, EditDefaultsOnly)
 	TSubclassOf<AStimulus> NegativeStimulusBP;
@@ -103,6 +107,12 @@ protected:
 	void DoSpawning();
 	void CancelSpawning();
 	void SpawnAgent();
+
+	/* Agents are replicated, what the player spawns is spawned by the server */
+	UFUNCTION(Server, Reliable)
+	void ServerSpawnSelection(EFlockAIGamemode Gamemode, FVector Location, FRotator Rotation);
+	void SpawnSelection(EFlockAIGamemode Gamemode, const FVector& Location, const FRotator& Rotation);
+
 	template <EFlockAIGamemode Gamemode>
 	void ChangeGamemode();
 
@@ -0,0 +1,24 @@
+// Flock AI - Steering Behaviors for Unreal - juaxix
+
+#pragma once
+
+#include "FlockBehaviourModule.h"
+#include "FlockWanderModule.generated.h"
+
+/* Sample behaviour module of the game: every boid drifts left and right of its heading following a smooth noise of its location */
+UCLASS(meta = (DisplayName = "Wander"))
+class FLOCKAIGAME_API UFlockWanderModule : public UFlockBehaviourModule
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Evaluate(const FFlockBehaviourContext& Context, int32 Begin, int32 End, TArrayView<FVector3f> OutForces) const override;
+
+	/* Distance between two turns of the noise along the path of a boid */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour", meta = (ClampMin = 1.0f))
+	float WanderWavelength = 2000.0f;
+
+	/* How fast the noise changes for a boid standing still, in turns per second */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "AI|Behaviour", meta = (ClampMin = 0.0f))
+	float WanderRate = 0.2f;
+};